@@ -13,7 +13,7 @@ common_flags="-g -fdiagnostics-plain-output"
 # -Ibuild needs to be included so that gcc can find the .gch file
 compiler_flags="$common_flags -Werror -Wall -Wextra -Ibuild"
 linker_flags="$common_flags"
-linker_libs="-lncursesw"
+linker_libs="-lncursesw -lpthread"
 
 options=$(getopt --options=t:xgB --longoptions=clean,test:,execute,debug,trace --name "$0" -- "$@")
 [ $? = 0 ] || exit 1
@@ -0,0 +1,231 @@
+#include "tabular.h"
+
+#define ARENA_ALIGN(size) (((size) + sizeof(void*) - 1) & ~(sizeof(void*) - 1))
+
+/* index of the largest class that fits into the size */
+static size_t arena_floorclass(size_t size)
+{
+	size_t c;
+
+	for (c = 0; c + 1 < ARENA_NUM_CLASSES &&
+			(ARENA_MIN_CLASS << (c + 1)) <= size; c++);
+	return c;
+}
+
+/* index of the smallest class the size fits into */
+static size_t arena_ceilclass(size_t size)
+{
+	size_t c;
+
+	for (c = 0; (ARENA_MIN_CLASS << c) < size; c++);
+	return c;
+}
+
+static void *arena_alloclarge(Arena *arena, size_t size)
+{
+	struct arena_block *block;
+
+	block = malloc(sizeof(*block) + size);
+	if (block == NULL)
+		return NULL;
+	block->prev = NULL;
+	block->next = arena->large;
+	if (arena->large != NULL)
+		arena->large->prev = block;
+	block->size = size;
+	block->used = size;
+	arena->large = block;
+	return block->data;
+}
+
+static struct arena_block *arena_largeblock(void *ptr)
+{
+	return (struct arena_block*) ((char*) ptr -
+			offsetof(struct arena_block, data));
+}
+
+static void arena_freelarge(Arena *arena, void *ptr)
+{
+	struct arena_block *const block = arena_largeblock(ptr);
+
+	if (block->prev == NULL)
+		arena->large = block->next;
+	else
+		block->prev->next = block->next;
+	if (block->next != NULL)
+		block->next->prev = block->prev;
+	free(block);
+}
+
+void *arena_alloc(Arena *arena, size_t size)
+{
+	struct arena_block *block;
+	void **pool;
+	void *ptr;
+
+	if (size == 0)
+		size = 1;
+	if (size > ARENA_MAX_CLASS)
+		return arena_alloclarge(arena, size);
+
+	size = ARENA_ALIGN(size);
+	pool = &arena->pools[arena_ceilclass(size)];
+	if (*pool != NULL) {
+		ptr = *pool;
+		*pool = *(void**) ptr;
+		return ptr;
+	}
+
+	block = arena->blocks;
+	if (block == NULL || block->size - block->used < size) {
+		block = malloc(sizeof(*block) + ARENA_BLOCK_SIZE);
+		if (block == NULL)
+			return NULL;
+		block->prev = NULL;
+		block->next = arena->blocks;
+		block->size = ARENA_BLOCK_SIZE;
+		block->used = 0;
+		arena->blocks = block;
+	}
+	ptr = block->data + block->used;
+	block->used += size;
+	return ptr;
+}
+
+void arena_free(Arena *arena, void *ptr, size_t size)
+{
+	size_t c;
+
+	if (ptr == NULL)
+		return;
+	if (size > ARENA_MAX_CLASS) {
+		arena_freelarge(arena, ptr);
+		return;
+	}
+	size = ARENA_ALIGN(size);
+	/* give the space back if it was the last allocation */
+	if (arena->blocks != NULL && (char*) ptr + size ==
+			arena->blocks->data + arena->blocks->used) {
+		arena->blocks->used -= size;
+		return;
+	}
+	if (size < ARENA_MIN_CLASS)
+		return;
+	c = arena_floorclass(size);
+	*(void**) ptr = arena->pools[c];
+	arena->pools[c] = ptr;
+}
+
+void *arena_realloc(Arena *arena, void *ptr, size_t oldSize, size_t newSize)
+{
+	void *newPtr;
+
+	if (ptr == NULL)
+		return arena_alloc(arena, newSize);
+	if (oldSize > ARENA_MAX_CLASS && newSize > ARENA_MAX_CLASS) {
+		struct arena_block *block, *newBlock;
+
+		block = arena_largeblock(ptr);
+		newBlock = realloc(block, sizeof(*block) + newSize);
+		if (newBlock == NULL)
+			return NULL;
+		if (newBlock->prev == NULL)
+			arena->large = newBlock;
+		else
+			newBlock->prev->next = newBlock;
+		if (newBlock->next != NULL)
+			newBlock->next->prev = newBlock;
+		newBlock->size = newSize;
+		newBlock->used = newSize;
+		return newBlock->data;
+	}
+	if (oldSize <= ARENA_MAX_CLASS && newSize <= ARENA_MAX_CLASS) {
+		const size_t oldAligned = ARENA_ALIGN(oldSize);
+		const size_t newAligned = ARENA_ALIGN(newSize);
+		struct arena_block *const block = arena->blocks;
+
+		if (newAligned <= oldAligned)
+			return ptr;
+		/* grow in place when it was the last allocation */
+		if (block != NULL && (char*) ptr + oldAligned ==
+				block->data + block->used &&
+				block->size - block->used >=
+					newAligned - oldAligned) {
+			block->used += newAligned - oldAligned;
+			return ptr;
+		}
+	}
+	newPtr = arena_alloc(arena, newSize);
+	if (newPtr == NULL)
+		return NULL;
+	memcpy(newPtr, ptr, MIN(oldSize, newSize));
+	arena_free(arena, ptr, oldSize);
+	return newPtr;
+}
+
+char *arena_strndup(Arena *arena, const char *str, size_t length)
+{
+	char *dup;
+
+	dup = arena_alloc(arena, length + 1);
+	if (dup == NULL)
+		return NULL;
+	memcpy(dup, str, length);
+	dup[length] = '\0';
+	return dup;
+}
+
+void arena_merge(Arena *arena, Arena *other)
+{
+	struct arena_block *block;
+
+	/* the blocks go behind the current block so that it is
+	 * still the one that is bumped
+	 */
+	if (other->blocks != NULL) {
+		for (block = other->blocks; block->next != NULL;
+				block = block->next);
+		if (arena->blocks == NULL) {
+			arena->blocks = other->blocks;
+		} else {
+			block->next = arena->blocks->next;
+			arena->blocks->next = other->blocks;
+		}
+	}
+
+	if (other->large != NULL) {
+		for (block = other->large; block->next != NULL;
+				block = block->next);
+		block->next = arena->large;
+		if (arena->large != NULL)
+			arena->large->prev = block;
+		arena->large = other->large;
+	}
+
+	for (size_t c = 0; c < ARENA_NUM_CLASSES; c++) {
+		void **tail;
+
+		if (other->pools[c] == NULL)
+			continue;
+		for (tail = &other->pools[c]; *tail != NULL;
+				tail = (void**) *tail);
+		*tail = arena->pools[c];
+		arena->pools[c] = other->pools[c];
+	}
+	memset(other, 0, sizeof(*other));
+}
+
+void arena_release(Arena *arena)
+{
+	struct arena_block *block, *next;
+
+	for (block = arena->blocks; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+	for (block = arena->large; block != NULL; block = next) {
+		next = block->next;
+		free(block);
+	}
+	memset(arena, 0, sizeof(*arena));
+}
@@ -0,0 +1,37 @@
+/* Bump allocator that owns the storage of a table.
+ *
+ * Small allocations are carved out of large blocks and have no
+ * header, the caller passes the size back in when freeing or
+ * resizing. Freed small allocations are kept in pools of size
+ * classes (16, 32, ..., ARENA_MAX_CLASS bytes) and reused. Anything
+ * larger gets a block of its own that is returned to the system
+ * immediately, a pool would waste all but ARENA_MAX_CLASS bytes of it.
+ * Everything is released at once by arena_release().
+ */
+#define ARENA_BLOCK_SIZE ((size_t) 1 << 20)
+#define ARENA_MIN_CLASS ((size_t) 16)
+#define ARENA_MAX_CLASS ((size_t) 4096)
+#define ARENA_NUM_CLASSES 9
+
+struct arena_block {
+	struct arena_block *prev;
+	struct arena_block *next;
+	size_t size;
+	size_t used;
+	_Alignas(max_align_t) char data[];
+};
+
+typedef struct arena {
+	/* the first block is the one that is currently bumped */
+	struct arena_block *blocks;
+	struct arena_block *large;
+	void *pools[ARENA_NUM_CLASSES];
+} Arena;
+
+void *arena_alloc(Arena *arena, size_t size);
+void *arena_realloc(Arena *arena, void *ptr, size_t oldSize, size_t newSize);
+void arena_free(Arena *arena, void *ptr, size_t size);
+char *arena_strndup(Arena *arena, const char *str, size_t length);
+/* Moves all memory of other into arena, other is empty afterwards. */
+void arena_merge(Arena *arena, Arena *other);
+void arena_release(Arena *arena);
@@ -10,7 +10,7 @@ void usage(int argc, char **argv)
 	fprintf(stderr, "--usage --help -h Shows this help\n");
 
 	fprintf(stderr, "1. Status:\n");
-	fprintf(stderr, "--info		Show table information (size and column names)\n");
+	fprintf(stderr, "--info		Show table information (size, column names and types)\n");
 	fprintf(stderr, "--view -v	View all selected cells in a terminal user interface\n");
 	fprintf(stderr, "--print -p	Print all selected cells\n");
 	fprintf(stderr, "--output -o	Output to a file or stdout\n");
@@ -33,12 +33,35 @@ void usage(int argc, char **argv)
 	fprintf(stderr, "--column -c	Select a column\n");
 	fprintf(stderr, "--set-row	Combination of --no-rows and --row\n");
 	fprintf(stderr, "--set-col	Combination of --no-columns and --column\n");
+	fprintf(stderr, "--where -w	Select the rows whose cell in a column matches, COL=PATTERN, or compares, COL<N, COL>=N\n");
+	fprintf(stderr, "--and-where	Keep the selected rows whose cell in a column matches or compares\n");
+	fprintf(stderr, "--or-where	Add the rows whose cell in a column matches or compares\n");
 	fprintf(stderr, "--undo		Undo a selection\n");
 	fprintf(stderr, "--redo		Redo a selection\n");
 
 	fprintf(stderr, "\n3. Modifying:\n");
 	fprintf(stderr, "--append	Append a row\n");
 	fprintf(stderr, "--append-col	Append a column\n");
+
+	fprintf(stderr, "\n4. Settings:\n");
+	fprintf(stderr, "Note: Settings apply to the whole command line, no matter where they are.\n");
+	fprintf(stderr, "--jobs -j	Number of threads used for loading and writing (default: number of processors)\n");
+	fprintf(stderr, "--cache		Load from and save to a snapshot next to the input file (<file>.tabcache)\n");
+	fprintf(stderr, "--lazy		Only parse the rows that are looked at, changing the table parses all of them\n");
+	fprintf(stderr, "--quote		Quote all cells when writing (all, the default) or only those that need it (minimal),\n\t\tkeep copies rows that were not changed from their file (keep)\n");
+	fprintf(stderr, "--history-mem	Memory the undo history may take before older steps are moved to a temporary file,\n\t\tK, M and G suffixes are allowed (default: 64M)\n");
+	fprintf(stderr, "--index		Index the cells in the background after loading, patterns with three or more characters\n\t\tbetween their stars then only test the rows that contain them\n");
+}
+
+/* Settings are applied before all other operations. */
+static bool is_setting(enum table_operation operation)
+{
+	return operation == TABLE_OPERATION_JOBS ||
+		operation == TABLE_OPERATION_CACHE ||
+		operation == TABLE_OPERATION_LAZY ||
+		operation == TABLE_OPERATION_QUOTE ||
+		operation == TABLE_OPERATION_HISTORY_MEM ||
+		operation == TABLE_OPERATION_INDEX;
 }
 
 int main(int argc, char **argv)
@@ -64,17 +87,29 @@ int main(int argc, char **argv)
 		[TABLE_OPERATION_COL] = { "col", 1, 0, 'c' },
 		[TABLE_OPERATION_SET_ROW] = { "set-row", 1, 0, 0 },
 		[TABLE_OPERATION_SET_COL] = { "set-col", 1, 0, 0 },
+		[TABLE_OPERATION_WHERE] = { "where", 1, 0, 'w' },
+		[TABLE_OPERATION_AND_WHERE] = { "and-where", 1, 0, 0 },
+		[TABLE_OPERATION_OR_WHERE] = { "or-where", 1, 0, 0 },
 
 		[TABLE_OPERATION_APPEND] = { "append", 2, 0, 'd' },
 		[TABLE_OPERATION_APPEND_COL] = { "append-col", 2, 0, 'n' },
 
 		[TABLE_OPERATION_UNDO] = { "undo", 0, 0, 0 },
 		[TABLE_OPERATION_REDO] = { "redo", 0, 0, 0 },
+
+		[TABLE_OPERATION_JOBS] = { "jobs", 1, 0, 'j' },
+		[TABLE_OPERATION_CACHE] = { "cache", 0, 0, 0 },
+		[TABLE_OPERATION_LAZY] = { "lazy", 0, 0, 0 },
+		[TABLE_OPERATION_QUOTE] = { "quote", 1, 0, 0 },
+		[TABLE_OPERATION_HISTORY_MEM] = { "history-mem", 1, 0, 0 },
+		[TABLE_OPERATION_INDEX] = { "index", 0, 0, 0 },
 		{ 0, 0, 0, 0 }
 	};
 	Table table;
 	char opt;
 	int optionIndex;
+	struct table_command *operations;
+	size_t numOperations;
 
 	setlocale(LC_ALL, "");
 
@@ -85,26 +120,52 @@ int main(int argc, char **argv)
 
 	table_init(&table);
 
+	/* every argument is at most one operation */
+	operations = malloc(sizeof(*operations) * argc);
+	if (operations == NULL) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
+		return 1;
+	}
+	numOperations = 0;
+
 	if (argv[1][0] != '-') {
 		/* explicit --input */
-		table_dooperation(&table, TABLE_OPERATION_INPUT, argv[1]);
+		operations[numOperations].operation = TABLE_OPERATION_INPUT;
+		operations[numOperations].arg = argv[1];
+		numOperations++;
 		optind = 2;
 	}
-	while ((opt = getopt_long(argc, argv, "ac:d::n::o::i:pr:v",
+	while ((opt = getopt_long(argc, argv, "ac:d::n::o::i:j:pr:vw:",
 			longOptions, &optionIndex)) >= 0) {
+		enum table_operation operation;
+
 		switch (opt) {
 		case 0:
-			table_dooperation(&table, optionIndex, optarg);
+			operation = optionIndex;
 			break;
 		default:
-			for (size_t i = 0; i < ARRLEN(longOptions); i++)
-				if (longOptions[i].val == opt) {
-					table_dooperation(&table, i, optarg);
+			for (operation = 0; operation < ARRLEN(longOptions);
+					operation++)
+				if (longOptions[operation].val == opt)
 					break;
-				}
+			if (operation == ARRLEN(longOptions))
+				continue;
 		}
+		if (is_setting(operation)) {
+			table_dooperation(&table, operation, optarg);
+			continue;
+		}
+		operations[numOperations].operation = operation;
+		operations[numOperations].arg = optarg;
+		numOperations++;
 	}
 
+	if (table_stream(&table, operations, numOperations) > 0)
+		for (size_t i = 0; i < numOperations; i++)
+			table_dooperation(&table, operations[i].operation,
+					operations[i].arg);
+
+	free(operations);
 	table_uninit(&table);
 	return 0;
 }
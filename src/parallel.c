@@ -0,0 +1,60 @@
+#include "tabular.h"
+
+#include <pthread.h>
+
+struct parallel_job {
+	void (*fn)(void *arg, size_t job);
+	void *arg;
+	size_t job;
+};
+
+static void *parallel_start(void *arg)
+{
+	const struct parallel_job *const job = arg;
+
+	job->fn(job->arg, job->job);
+	return NULL;
+}
+
+void parallel_run(size_t numJobs, void (*fn)(void *arg, size_t job), void *arg)
+{
+	pthread_t *threads;
+	struct parallel_job *jobs;
+	bool *started;
+
+	if (numJobs <= 1) {
+		if (numJobs == 1)
+			fn(arg, 0);
+		return;
+	}
+
+	threads = malloc(sizeof(*threads) * numJobs);
+	jobs = malloc(sizeof(*jobs) * numJobs);
+	started = calloc(numJobs, sizeof(*started));
+	if (threads == NULL || jobs == NULL || started == NULL) {
+		free(threads);
+		free(jobs);
+		free(started);
+		for (size_t i = 0; i < numJobs; i++)
+			fn(arg, i);
+		return;
+	}
+
+	for (size_t i = 1; i < numJobs; i++) {
+		jobs[i].fn = fn;
+		jobs[i].arg = arg;
+		jobs[i].job = i;
+		started[i] = pthread_create(&threads[i], NULL, parallel_start,
+				&jobs[i]) == 0;
+	}
+	fn(arg, 0);
+	for (size_t i = 1; i < numJobs; i++) {
+		if (started[i])
+			pthread_join(threads[i], NULL);
+		else
+			fn(arg, i);
+	}
+	free(threads);
+	free(jobs);
+	free(started);
+}
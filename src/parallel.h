@@ -0,0 +1,6 @@
+/* Runs fn(arg, job) for every job from 0 to numJobs - 1, each on its
+ * own thread (the calling thread runs job 0). Returns when all jobs
+ * are done. Jobs that can not get a thread run on the calling thread
+ * instead.
+ */
+void parallel_run(size_t numJobs, void (*fn)(void *arg, size_t job), void *arg);
@@ -0,0 +1,148 @@
+#include "tabular.h"
+
+int pattern_compile(Pattern *pattern, const Utf8 *source)
+{
+	const size_t length = strlen(source);
+	size_t maxAlternatives = 1, maxPieces;
+	struct pattern_piece *piece;
+	char *text;
+
+	/* each alternative has one piece more than it has stars at most */
+	for (size_t i = 0; i < length; i++)
+		maxAlternatives += source[i] == '|';
+	maxPieces = maxAlternatives;
+	for (size_t i = 0; i < length; i++)
+		maxPieces += source[i] == '*';
+	pattern->alternatives = malloc(sizeof(*pattern->alternatives) *
+			maxAlternatives);
+	pattern->pieces = malloc(sizeof(*pattern->pieces) * maxPieces);
+	pattern->text = malloc(length + maxPieces);
+	if (pattern->alternatives == NULL || pattern->pieces == NULL ||
+			pattern->text == NULL) {
+		pattern_free(pattern);
+		return -1;
+	}
+
+	pattern->numAlternatives = 0;
+	piece = pattern->pieces;
+	text = pattern->text;
+	do {
+		struct pattern_alternative *const alternative =
+			&pattern->alternatives[pattern->numAlternatives++];
+		bool hasStar = false, endsInStar = false, valid = true;
+
+		alternative->anchoredStart = *source != '*';
+		alternative->pieces = piece;
+		piece->text = text;
+		for (; *source != '\0' && *source != '|'; source++) {
+			if (*source == '*') {
+				hasStar = true;
+				endsInStar = true;
+				/* stars in a row leave no empty pieces */
+				if (text != piece->text) {
+					piece->length = text - piece->text;
+					*text++ = '\0';
+					piece++;
+					piece->text = text;
+				}
+				continue;
+			}
+			if (*source == '\\' && *++source == '\0') {
+				valid = false;
+				break;
+			}
+			*text++ = *source;
+			endsInStar = false;
+		}
+		if (text != piece->text || !hasStar) {
+			piece->length = text - piece->text;
+			*text++ = '\0';
+			piece++;
+		}
+		alternative->anchoredEnd = !endsInStar;
+		alternative->numPieces = piece - alternative->pieces;
+		alternative->kind = !valid ? PATTERN_NONE :
+			!hasStar ? PATTERN_EXACT :
+			alternative->numPieces == 0 ? PATTERN_ANY : PATTERN_GLOB;
+	} while (*source++ == '|');
+
+	/* with several alternatives no single piece is needed */
+	pattern->literal = NULL;
+	pattern->lenLiteral = 0;
+	if (pattern->numAlternatives == 1 &&
+			pattern->alternatives[0].kind != PATTERN_NONE)
+		for (size_t i = 0; i < pattern->alternatives[0].numPieces; i++) {
+			const struct pattern_piece *const candidate =
+				&pattern->alternatives[0].pieces[i];
+			if (candidate->length > pattern->lenLiteral) {
+				pattern->literal = candidate->text;
+				pattern->lenLiteral = candidate->length;
+			}
+		}
+	return 0;
+}
+
+static bool pattern_matchglob(const struct pattern_alternative *alternative,
+		const char *text)
+{
+	const struct pattern_piece *piece = alternative->pieces;
+	const struct pattern_piece *end = &piece[alternative->numPieces];
+	const char *limit = NULL;
+
+	if (alternative->anchoredStart) {
+		if (strncmp(text, piece->text, piece->length) != 0)
+			return false;
+		text += piece->length;
+		piece++;
+	}
+	if (alternative->anchoredEnd) {
+		const size_t length = strlen(text);
+
+		end--;
+		if (length < end->length || memcmp(&text[length - end->length],
+					end->text, end->length) != 0)
+			return false;
+		limit = &text[length - end->length];
+	}
+	for (; piece != end; piece++) {
+		const char *const found = strstr(text, piece->text);
+
+		/* a later occurrence would not fit either */
+		if (found == NULL ||
+				(limit != NULL && &found[piece->length] > limit))
+			return false;
+		text = &found[piece->length];
+	}
+	return true;
+}
+
+bool pattern_match(const Pattern *pattern, const Utf8 *text)
+{
+	for (size_t i = 0; i < pattern->numAlternatives; i++) {
+		const struct pattern_alternative *const alternative =
+			&pattern->alternatives[i];
+
+		switch (alternative->kind) {
+		case PATTERN_NONE:
+			break;
+		case PATTERN_EXACT:
+			if (!strcmp(text, alternative->pieces[0].text))
+				return true;
+			break;
+		case PATTERN_ANY:
+			return true;
+		case PATTERN_GLOB:
+			if (pattern_matchglob(alternative, text))
+				return true;
+			break;
+		}
+	}
+	return false;
+}
+
+void pattern_free(Pattern *pattern)
+{
+	free(pattern->alternatives);
+	free(pattern->pieces);
+	free(pattern->text);
+}
@@ -0,0 +1,55 @@
+/* Glob patterns that are compiled once and then matched against many
+ * cells.
+ *
+ * A pattern is a list of alternatives separated by '|', a text matches
+ * when it matches any of them. Within an alternative '*' matches any
+ * text and a backslash makes the next character literal. Each
+ * alternative is kept as the literal pieces between its stars: the
+ * first and last piece are compared at the ends of the text, the others
+ * are searched for from left to right. The leftmost occurrence of a
+ * piece is always the best one, so matching never backtracks and takes
+ * time linear in the length of the text.
+ */
+struct pattern_piece {
+	const char *text;
+	size_t length;
+};
+
+struct pattern_alternative {
+	enum pattern_kind {
+		/* ends in a lone backslash, matches nothing */
+		PATTERN_NONE,
+		/* no stars, the only piece is the whole text */
+		PATTERN_EXACT,
+		/* only stars */
+		PATTERN_ANY,
+		PATTERN_GLOB,
+	} kind;
+	/* whether the first piece is at the start of the text and the last
+	 * one at its end, that is whether there is no star before or after
+	 */
+	bool anchoredStart;
+	bool anchoredEnd;
+	struct pattern_piece *pieces;
+	size_t numPieces;
+};
+
+typedef struct pattern {
+	struct pattern_alternative *alternatives;
+	size_t numAlternatives;
+	/* the pieces of all alternatives */
+	struct pattern_piece *pieces;
+	/* the null terminated texts of the pieces */
+	char *text;
+	/* The longest piece that every matching text contains, NULL when
+	 * there is none. Texts without it are rejected by searching for it
+	 * before matching.
+	 */
+	const char *literal;
+	size_t lenLiteral;
+} Pattern;
+
+/* Returns -1 and sets errno when memory runs out. */
+int pattern_compile(Pattern *pattern, const Utf8 *source);
+bool pattern_match(const Pattern *pattern, const Utf8 *text);
+void pattern_free(Pattern *pattern);
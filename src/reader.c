@@ -0,0 +1,195 @@
+#include "tabular.h"
+
+static ssize_t reader_read(Reader *reader, struct reader_buffer *buffer)
+{
+	ssize_t count;
+
+	do
+		count = read(reader->fd, buffer->data, READER_BUFFER_SIZE);
+	while (count < 0 && errno == EINTR);
+	return count;
+}
+
+static void *reader_produce(void *arg)
+{
+	Reader *const reader = arg;
+
+	/* the thread may only be cancelled while it waits for read() */
+	pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+	pthread_mutex_lock(&reader->lock);
+	while (!reader->stop && !reader->eof) {
+		struct reader_buffer *const buffer =
+			&reader->buffers[reader->produce];
+		ssize_t count;
+		int error;
+
+		if (buffer->full) {
+			pthread_cond_wait(&reader->cond, &reader->lock);
+			continue;
+		}
+		pthread_mutex_unlock(&reader->lock);
+		pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+		count = reader_read(reader, buffer);
+		error = count < 0 ? errno : 0;
+		pthread_setcancelstate(PTHREAD_CANCEL_DISABLE, NULL);
+		pthread_mutex_lock(&reader->lock);
+		if (count <= 0) {
+			reader->eof = true;
+			reader->error = error;
+		} else {
+			buffer->length = count;
+			buffer->full = true;
+			reader->produce = (reader->produce + 1) %
+				READER_NUM_BUFFERS;
+		}
+		pthread_cond_broadcast(&reader->cond);
+	}
+	pthread_mutex_unlock(&reader->lock);
+	return NULL;
+}
+
+int reader_open(Reader *reader, int fd)
+{
+	const long pageSize = sysconf(_SC_PAGESIZE);
+
+	memset(reader, 0, sizeof(*reader));
+	reader->fd = fd;
+	/* fails for pipes, which is fine */
+	posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	for (size_t i = 0; i < READER_NUM_BUFFERS; i++) {
+		void *data;
+
+		errno = posix_memalign(&data, pageSize > 0 ? pageSize : 4096,
+				READER_BUFFER_SIZE);
+		if (errno != 0) {
+			while (i > 0)
+				free(reader->buffers[--i].data);
+			return -1;
+		}
+		reader->buffers[i].data = data;
+	}
+	pthread_mutex_init(&reader->lock, NULL);
+	pthread_cond_init(&reader->cond, NULL);
+	reader->threaded = pthread_create(&reader->thread, NULL,
+			reader_produce, reader) == 0;
+	return 0;
+}
+
+/* Gives the current buffer back and makes the next filled one current,
+ * returns false when there is none.
+ */
+static bool reader_next(Reader *reader)
+{
+	struct reader_buffer *buffer;
+	bool full;
+
+	if (reader->threaded)
+		pthread_mutex_lock(&reader->lock);
+	if (reader->holding) {
+		reader->buffers[reader->consume].full = false;
+		reader->consume = (reader->consume + 1) % READER_NUM_BUFFERS;
+		reader->holding = false;
+	}
+	buffer = &reader->buffers[reader->consume];
+	if (reader->threaded) {
+		pthread_cond_broadcast(&reader->cond);
+		while (!buffer->full && !reader->eof)
+			pthread_cond_wait(&reader->cond, &reader->lock);
+		full = buffer->full;
+		pthread_mutex_unlock(&reader->lock);
+	} else if (!reader->eof) {
+		const ssize_t count = reader_read(reader, buffer);
+		if (count <= 0) {
+			reader->eof = true;
+			reader->error = count < 0 ? errno : 0;
+		} else {
+			buffer->length = count;
+			buffer->full = true;
+		}
+		full = buffer->full;
+	} else {
+		full = false;
+	}
+	if (!full)
+		return false;
+	reader->pos = buffer->data;
+	reader->end = buffer->data + buffer->length;
+	reader->holding = true;
+	return true;
+}
+
+static int reader_carry(Reader *reader, const char *text, size_t length)
+{
+	if (reader->lenCarry + length + 1 > reader->capCarry) {
+		char *newCarry;
+		size_t newCap;
+
+		newCap = MAX(reader->capCarry * 2,
+				reader->lenCarry + length + 1);
+		newCarry = realloc(reader->carry, newCap);
+		if (newCarry == NULL)
+			return -1;
+		reader->carry = newCarry;
+		reader->capCarry = newCap;
+	}
+	memcpy(&reader->carry[reader->lenCarry], text, length);
+	reader->lenCarry += length;
+	reader->carry[reader->lenCarry] = '\0';
+	return 0;
+}
+
+char *reader_getline(Reader *reader, size_t *pLength)
+{
+	char *line, *newline;
+	size_t length;
+
+	reader->lenCarry = 0;
+	while (1) {
+		newline = reader->pos == reader->end ? NULL :
+			memchr(reader->pos, '\n', reader->end - reader->pos);
+		if (newline != NULL)
+			break;
+		if (reader->pos != reader->end && reader_carry(reader,
+				reader->pos, reader->end - reader->pos) < 0)
+			return NULL;
+		reader->pos = reader->end;
+		if (!reader_next(reader)) {
+			errno = reader->error;
+			/* the last line does not need a line feed */
+			if (reader->lenCarry == 0 || reader->error != 0)
+				return NULL;
+			*pLength = reader->lenCarry;
+			return reader->carry;
+		}
+	}
+	*newline = '\0';
+	line = reader->pos;
+	length = newline - line;
+	reader->pos = newline + 1;
+	if (reader->lenCarry == 0) {
+		*pLength = length;
+		return line;
+	}
+	if (reader_carry(reader, line, length) < 0)
+		return NULL;
+	*pLength = reader->lenCarry;
+	return reader->carry;
+}
+
+void reader_close(Reader *reader)
+{
+	if (reader->threaded) {
+		pthread_mutex_lock(&reader->lock);
+		reader->stop = true;
+		pthread_cond_broadcast(&reader->cond);
+		pthread_mutex_unlock(&reader->lock);
+		/* it might wait for a pipe that is never written to */
+		pthread_cancel(reader->thread);
+		pthread_join(reader->thread, NULL);
+	}
+	pthread_cond_destroy(&reader->cond);
+	pthread_mutex_destroy(&reader->lock);
+	for (size_t i = 0; i < READER_NUM_BUFFERS; i++)
+		free(reader->buffers[i].data);
+	free(reader->carry);
+}
@@ -0,0 +1,52 @@
+/* Reads lines from a file descriptor while they are being parsed.
+ *
+ * A producer thread fills READER_NUM_BUFFERS aligned buffers with
+ * read() ahead of the consumer, so that waiting for the disk or a pipe
+ * overlaps with parsing. Lines are handed out in place and terminated
+ * there, only lines that cross the end of a buffer are copied. Without
+ * a thread, the buffers are filled on demand instead.
+ */
+#define READER_BUFFER_SIZE ((size_t) 1 << 20)
+#define READER_NUM_BUFFERS 3
+
+typedef struct reader {
+	int fd;
+	pthread_t thread;
+	bool threaded;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	struct reader_buffer {
+		/* READER_BUFFER_SIZE bytes, lines are terminated at their
+		 * line feed and the last line without one is copied, so
+		 * nothing is ever written behind length
+		 */
+		char *data;
+		size_t length;
+		bool full;
+	} buffers[READER_NUM_BUFFERS];
+	/* next buffer to be filled and to be consumed */
+	size_t produce;
+	size_t consume;
+	/* set by the producer when there is nothing more to read */
+	bool eof;
+	int error;
+	/* set by reader_close() */
+	bool stop;
+	/* rest of the buffer that is being consumed */
+	char *pos;
+	char *end;
+	bool holding;
+	/* line that crosses the end of a buffer */
+	char *carry;
+	size_t lenCarry;
+	size_t capCarry;
+} Reader;
+
+int reader_open(Reader *reader, int fd);
+/* Returns the next line without its line feed and null terminated, it
+ * can be modified and stays valid until the next call. Returns NULL at
+ * the end of the file or on failure, errno is set in the latter case.
+ */
+char *reader_getline(Reader *reader, size_t *pLength);
+/* Does not close the file descriptor */
+void reader_close(Reader *reader);
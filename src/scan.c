@@ -0,0 +1,257 @@
+#include "tabular.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define SCAN_X86
+#endif
+
+static void scan_block_scalar(const char *text, struct scan_block *block)
+{
+	uint64_t separators = 0, quotes = 0, nuls = 0;
+
+	for (unsigned i = 0; i < 64; i++) {
+		const uint64_t bit = (uint64_t) 1 << i;
+		switch (text[i]) {
+		case '\t':
+		case ',':
+		case ';':
+			separators |= bit;
+			break;
+		case '\"':
+			quotes |= bit;
+			break;
+		case '\0':
+			nuls |= bit;
+			break;
+		}
+	}
+	block->separators = separators;
+	block->quotes = quotes;
+	block->nuls = nuls;
+}
+
+#ifdef SCAN_X86
+
+__attribute__((target("sse2")))
+static void scan_block_sse2(const char *text, struct scan_block *block)
+{
+	const __m128i tab = _mm_set1_epi8('\t');
+	const __m128i comma = _mm_set1_epi8(',');
+	const __m128i semicolon = _mm_set1_epi8(';');
+	const __m128i quote = _mm_set1_epi8('\"');
+	const __m128i zero = _mm_setzero_si128();
+	uint64_t separators = 0, quotes = 0, nuls = 0;
+
+	for (unsigned i = 0; i < 64; i += 16) {
+		const __m128i v = _mm_loadu_si128((const __m128i*) &text[i]);
+		const __m128i s = _mm_or_si128(_mm_or_si128(
+				_mm_cmpeq_epi8(v, tab),
+				_mm_cmpeq_epi8(v, comma)),
+				_mm_cmpeq_epi8(v, semicolon));
+		separators |= (uint64_t) (uint16_t) _mm_movemask_epi8(s) << i;
+		quotes |= (uint64_t) (uint16_t)
+			_mm_movemask_epi8(_mm_cmpeq_epi8(v, quote)) << i;
+		nuls |= (uint64_t) (uint16_t)
+			_mm_movemask_epi8(_mm_cmpeq_epi8(v, zero)) << i;
+	}
+	block->separators = separators;
+	block->quotes = quotes;
+	block->nuls = nuls;
+}
+
+__attribute__((target("avx2")))
+static void scan_block_avx2(const char *text, struct scan_block *block)
+{
+	const __m256i tab = _mm256_set1_epi8('\t');
+	const __m256i comma = _mm256_set1_epi8(',');
+	const __m256i semicolon = _mm256_set1_epi8(';');
+	const __m256i quote = _mm256_set1_epi8('\"');
+	const __m256i zero = _mm256_setzero_si256();
+	uint64_t separators = 0, quotes = 0, nuls = 0;
+
+	for (unsigned i = 0; i < 64; i += 32) {
+		const __m256i v = _mm256_loadu_si256((const __m256i*) &text[i]);
+		const __m256i s = _mm256_or_si256(_mm256_or_si256(
+				_mm256_cmpeq_epi8(v, tab),
+				_mm256_cmpeq_epi8(v, comma)),
+				_mm256_cmpeq_epi8(v, semicolon));
+		separators |= (uint64_t) (uint32_t)
+			_mm256_movemask_epi8(s) << i;
+		quotes |= (uint64_t) (uint32_t)
+			_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, quote)) << i;
+		nuls |= (uint64_t) (uint32_t)
+			_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, zero)) << i;
+	}
+	block->separators = separators;
+	block->quotes = quotes;
+	block->nuls = nuls;
+}
+
+#endif
+
+typedef void (*scan_block_fn)(const char *text, struct scan_block *block);
+
+static scan_block_fn scan_select(void)
+{
+	static scan_block_fn selected;
+	scan_block_fn fn;
+
+	fn = __atomic_load_n(&selected, __ATOMIC_RELAXED);
+	if (fn != NULL)
+		return fn;
+	fn = scan_block_scalar;
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		fn = scan_block_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		fn = scan_block_sse2;
+#endif
+	__atomic_store_n(&selected, fn, __ATOMIC_RELAXED);
+	return fn;
+}
+
+void scan_block(const char *text, struct scan_block *block)
+{
+	scan_select()(text, block);
+}
+
+static const char *scan_find_scalar(const char *text, size_t length,
+		const char *needle, size_t lenNeedle)
+{
+	return memmem(text, length, needle, lenNeedle);
+}
+
+#ifdef SCAN_X86
+
+/* Compares the first and the last byte of the needle at 16 or 32
+ * positions at once, only the positions where both are equal are
+ * compared in full.
+ */
+__attribute__((target("sse2")))
+static const char *scan_find_sse2(const char *text, size_t length,
+		const char *needle, size_t lenNeedle)
+{
+	const __m128i first = _mm_set1_epi8(needle[0]);
+	const __m128i last = _mm_set1_epi8(needle[lenNeedle - 1]);
+	size_t i;
+
+	for (i = 0; i + lenNeedle - 1 + 16 <= length; i += 16) {
+		const __m128i a = _mm_loadu_si128((const __m128i*) &text[i]);
+		const __m128i b = _mm_loadu_si128((const __m128i*)
+				&text[i + lenNeedle - 1]);
+		unsigned mask = _mm_movemask_epi8(_mm_and_si128(
+					_mm_cmpeq_epi8(a, first),
+					_mm_cmpeq_epi8(b, last)));
+
+		for (; mask != 0; mask &= mask - 1) {
+			const size_t at = i + __builtin_ctz(mask);
+			if (!memcmp(&text[at], needle, lenNeedle))
+				return &text[at];
+		}
+	}
+	return scan_find_scalar(&text[i], length - i, needle, lenNeedle);
+}
+
+__attribute__((target("avx2")))
+static const char *scan_find_avx2(const char *text, size_t length,
+		const char *needle, size_t lenNeedle)
+{
+	const __m256i first = _mm256_set1_epi8(needle[0]);
+	const __m256i last = _mm256_set1_epi8(needle[lenNeedle - 1]);
+	size_t i;
+
+	for (i = 0; i + lenNeedle - 1 + 32 <= length; i += 32) {
+		const __m256i a = _mm256_loadu_si256((const __m256i*) &text[i]);
+		const __m256i b = _mm256_loadu_si256((const __m256i*)
+				&text[i + lenNeedle - 1]);
+		uint32_t mask = _mm256_movemask_epi8(_mm256_and_si256(
+					_mm256_cmpeq_epi8(a, first),
+					_mm256_cmpeq_epi8(b, last)));
+
+		for (; mask != 0; mask &= mask - 1) {
+			const size_t at = i + __builtin_ctz(mask);
+			if (!memcmp(&text[at], needle, lenNeedle))
+				return &text[at];
+		}
+	}
+	return scan_find_scalar(&text[i], length - i, needle, lenNeedle);
+}
+
+#endif
+
+typedef const char *(*scan_find_fn)(const char *text, size_t length,
+		const char *needle, size_t lenNeedle);
+
+static scan_find_fn scan_selectfind(void)
+{
+	static scan_find_fn selected;
+	scan_find_fn fn;
+
+	fn = __atomic_load_n(&selected, __ATOMIC_RELAXED);
+	if (fn != NULL)
+		return fn;
+	fn = scan_find_scalar;
+#ifdef SCAN_X86
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+		fn = scan_find_avx2;
+	else if (__builtin_cpu_supports("sse2"))
+		fn = scan_find_sse2;
+#endif
+	__atomic_store_n(&selected, fn, __ATOMIC_RELAXED);
+	return fn;
+}
+
+const char *scan_find(const char *text, size_t length, const char *needle,
+		size_t lenNeedle)
+{
+	if (lenNeedle == 0)
+		return text;
+	if (lenNeedle > length)
+		return NULL;
+	return scan_selectfind()(text, length, needle, lenNeedle);
+}
+
+void scan_init(Scanner *scanner, const char *text, size_t length)
+{
+	scanner->text = text;
+	scanner->length = length;
+	scanner->base = SIZE_MAX;
+}
+
+static void scan_load(Scanner *scanner, size_t base)
+{
+	struct scan_block block;
+
+	if (base + 64 <= scanner->length + 1) {
+		scan_block(&scanner->text[base], &block);
+	} else {
+		/* the end of the line, pad it with null bytes so that
+		 * nothing after the terminator is read
+		 */
+		char tail[64];
+
+		memset(tail, 0, sizeof(tail));
+		memcpy(tail, &scanner->text[base], scanner->length - base);
+		scan_block(tail, &block);
+	}
+	scanner->base = base;
+	scanner->masks[SCAN_SEPARATOR] = block.separators | block.nuls;
+	scanner->masks[SCAN_QUOTE] = block.quotes | block.nuls;
+}
+
+size_t scan_next(Scanner *scanner, size_t pos, enum scan_kind kind)
+{
+	while (1) {
+		const size_t base = pos & ~(size_t) 63;
+		uint64_t mask;
+
+		if (base != scanner->base)
+			scan_load(scanner, base);
+		mask = scanner->masks[kind] >> (pos - base);
+		if (mask != 0)
+			return pos + __builtin_ctzll(mask);
+		pos = base + 64;
+	}
+}
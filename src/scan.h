@@ -0,0 +1,42 @@
+/* Finds the structural characters of a line 64 bytes at a time.
+ *
+ * scan_block() classifies a block into bitmasks where bit i stands for
+ * text[i], it uses AVX2 or SSE2 when the CPU has them (chosen at run
+ * time) and a scalar loop otherwise, all produce the same masks.
+ */
+struct scan_block {
+	/* '\t', ',' and ';' */
+	uint64_t separators;
+	uint64_t quotes;
+	uint64_t nuls;
+};
+
+void scan_block(const char *text, struct scan_block *block);
+
+/* Returns the first occurrence of the needle in the text or NULL, the
+ * text is searched a vector at a time like the blocks.
+ */
+const char *scan_find(const char *text, size_t length, const char *needle,
+		size_t lenNeedle);
+
+enum scan_kind {
+	/* next separator or end of the line */
+	SCAN_SEPARATOR,
+	/* next double quote or end of the line */
+	SCAN_QUOTE,
+};
+
+typedef struct scanner {
+	const char *text;
+	size_t length;
+	/* offset of the block the masks belong to */
+	size_t base;
+	uint64_t masks[2];
+} Scanner;
+
+/* The text must be null terminated at text[length]. */
+void scan_init(Scanner *scanner, const char *text, size_t length);
+/* Returns the index of the next character of the given kind starting
+ * at pos, the end of the line counts as both kinds.
+ */
+size_t scan_next(Scanner *scanner, size_t pos, enum scan_kind kind);
@@ -2,197 +2,772 @@
 
 int table_init(Table *table)
 {
+	long numProcessors;
+
 	memset(table, 0, sizeof(*table));
+	numProcessors = sysconf(_SC_NPROCESSORS_ONLN);
+	table->numJobs = numProcessors > 0 ? numProcessors : 1;
+	table->historyMem = TABLE_HISTORY_MEM;
 	return 0;
 }
 
-static void *table_realloc(Table *table, void *ptr, size_t newSize)
+const char *table_strerror(Table *table)
+{
+	return table->error;
+}
+
+static void *table_realloc(Table *table, void *ptr, size_t oldSize,
+		size_t newSize)
 {
-	ptr = realloc(ptr, newSize);
+	ptr = arena_realloc(&table->arena, ptr, oldSize, newSize);
 	if (ptr != NULL)
 		return ptr;
-	fprintf(stderr, "error: could not allocate %zu bytes: %s",
+	snprintf(table->error, sizeof(table->error),
+			"could not allocate %zu bytes: %s",
 			newSize, strerror(errno));
 	table->atText = NULL;
 	return NULL;
 }
 
-static char *table_parse_string(Table *table, const char *text, const char **pText)
+/* Every change to the table starts here: the rows of a lazy table are
+ * parsed, the index has to be done reading the table and the results of
+ * earlier searches no longer hold.
+ */
+static int table_beginchange(Table *table)
 {
-	char *str, *newStr;
-	size_t n;
+	table->version++;
+	table_waitindex(table);
+	return table_materialize(table);
+}
 
-	str = malloc(16);
-	n = 0;
-	if (*text == '\"') {
-		for (text++; *text != '\"'; text++) {
-			if (*text == '\0') {
-				fprintf(stderr, "error: missing closing double"
-						"quotes");
-				table->atText = text;
-				goto err;
+/* Splits the text into cells and stores them in table->slices,
+ * nothing is copied or modified. The text must be null terminated at
+ * text[length].
+ */
+static int table_parse_row(Table *table, const char *text, size_t length,
+		size_t *pNumCols)
+{
+	Scanner scanner;
+	size_t numCols;
+	size_t pos, start, end;
+
+	scan_init(&scanner, text, length);
+	numCols = 0;
+	pos = 0;
+	while (1) {
+		if (numCols == table->capSlices) {
+			struct table_slice *newSlices;
+			size_t newCap;
+
+			newCap = table->capSlices * 2 + 8;
+			newSlices = table_realloc(table, table->slices,
+					sizeof(*table->slices) *
+						table->capSlices,
+					sizeof(*table->slices) * newCap);
+			if (newSlices == NULL)
+				return -1;
+			table->slices = newSlices;
+			table->capSlices = newCap;
+		}
+
+		if (text[pos] == '\"') {
+			start = pos + 1;
+			end = scan_next(&scanner, start, SCAN_QUOTE);
+			if (text[end] != '\"') {
+				snprintf(table->error, sizeof(table->error),
+						"missing closing double quotes");
+				table->atText = &text[end];
+				return -1;
 			}
-			newStr = table_realloc(table, str, n + 1);
-			if (newStr == NULL)
-				goto err;
-			str = newStr;
-			str[n++] = *text;
+			pos = end + 1;
+		} else {
+			start = pos;
+			end = scan_next(&scanner, start, SCAN_SEPARATOR);
+			pos = end;
 		}
-		text++;
-	} else {
-		for (; *text != '\0' && *text != '\t' &&
-				*text != ',' && *text != ';'; text++) {
-			newStr = table_realloc(table, str, n + 1);
-			if (newStr == NULL)
-				goto err;
-			str = newStr;
-			str[n++] = *text;
+		while (start != end && isblank(text[start]))
+			start++;
+		while (end != start && isblank(text[end - 1]))
+			end--;
+		table->slices[numCols].start = (char*) &text[start];
+		table->slices[numCols].length = end - start;
+		numCols++;
+
+		if (text[pos] == '\0')
+			break;
+		if (text[pos] != ';' && text[pos] != ',' && text[pos] != '\t') {
+			snprintf(table->error, sizeof(table->error),
+					"missing separator");
+			table->atText = &text[pos];
+			return -1;
 		}
+		pos++;
+	}
+	*pNumCols = numCols;
+	return 0;
+}
+
+int table_initlike(Table *table, Table *header)
+{
+	table_init(table);
+	table->numJobs = header->numJobs;
+	table->quote = header->quote;
+	table->colNames = header->colNames;
+	table->numCols = header->numCols;
+	table->mappedText = header->mappedText;
+	table->columns = table_realloc(table, NULL, 0,
+			sizeof(*table->columns) * header->numCols);
+	if (table->columns == NULL)
+		return -1;
+	memset(table->columns, 0, sizeof(*table->columns) * header->numCols);
+	table->capCols = header->numCols;
+	return 0;
+}
+
+/* Grows a selection set from oldCap to newCap bits, the new bits are
+ * clear.
+ */
+static uint64_t *table_reserveset(Table *table, uint64_t *set,
+		size_t oldCap, size_t newCap)
+{
+	const size_t oldWords = TABLE_SET_WORDS(oldCap);
+	const size_t newWords = TABLE_SET_WORDS(newCap);
+	uint64_t *newSet;
+
+	newSet = table_realloc(table, set, sizeof(*set) * oldWords,
+			sizeof(*set) * newWords);
+	if (newSet == NULL)
+		return NULL;
+	memset(&newSet[oldWords], 0, sizeof(*newSet) * (newWords - oldWords));
+	return newSet;
+}
+
+int table_reserverows(Table *table, size_t numRows)
+{
+	size_t *newActiveRows;
+	uint64_t *newSet;
+	size_t newCap;
+
+	if (numRows <= table->capRows)
+		return 0;
+	newCap = MAX(numRows, table->capRows * 2 + 64);
+
+	newActiveRows = table_realloc(table, table->activeRows,
+			sizeof(*table->activeRows) * table->capRows,
+			sizeof(*table->activeRows) * newCap);
+	if (newActiveRows == NULL)
+		return -1;
+	table->activeRows = newActiveRows;
+
+	newSet = table_reserveset(table, table->rowSet, table->capRows,
+			newCap);
+	if (newSet == NULL)
+		return -1;
+	table->rowSet = newSet;
+
+	newSet = table_reserveset(table, table->newRowSet, table->capRows,
+			newCap);
+	if (newSet == NULL)
+		return -1;
+	table->newRowSet = newSet;
+	table->capRows = newCap;
+	return 0;
+}
+
+int table_reservecols(Table *table, size_t numCols)
+{
+	Utf8 **newColumnNames;
+	struct table_column *newColumns;
+	size_t *newActiveCols;
+	uint64_t *newSet;
+	size_t newCap;
+
+	if (numCols <= table->capCols)
+		return 0;
+	newCap = MAX(numCols, table->capCols * 2);
+
+	newColumnNames = table_realloc(table, table->colNames,
+			sizeof(*table->colNames) * table->capCols,
+			sizeof(*table->colNames) * newCap);
+	if (newColumnNames == NULL)
+		return -1;
+	table->colNames = newColumnNames;
+
+	newColumns = table_realloc(table, table->columns,
+			sizeof(*table->columns) * table->capCols,
+			sizeof(*table->columns) * newCap);
+	if (newColumns == NULL)
+		return -1;
+	memset(&newColumns[table->capCols], 0,
+			sizeof(*newColumns) * (newCap - table->capCols));
+	table->columns = newColumns;
+
+	newActiveCols = table_realloc(table, table->activeCols,
+			sizeof(*table->activeCols) * table->capCols,
+			sizeof(*table->activeCols) * newCap);
+	if (newActiveCols == NULL)
+		return -1;
+	table->activeCols = newActiveCols;
+
+	newSet = table_reserveset(table, table->colSet, table->capCols,
+			newCap);
+	if (newSet == NULL)
+		return -1;
+	table->colSet = newSet;
+
+	newSet = table_reserveset(table, table->newColSet, table->capCols,
+			newCap);
+	if (newSet == NULL)
+		return -1;
+	table->newColSet = newSet;
+	table->capCols = newCap;
+	return 0;
+}
+
+static int table_reservecells(Table *table, struct table_column *column,
+		size_t numCells)
+{
+	size_t *newOffsets;
+	size_t newCap;
+
+	if (numCells <= column->capOffsets)
+		return 0;
+	newCap = MAX(numCells, column->capOffsets * 2 + 64);
+	/* offsets borrowed from a snapshot are copied when they grow */
+	if (column->capOffsets == 0 && column->offsets != NULL) {
+		newOffsets = table_realloc(table, NULL, 0,
+				sizeof(*column->offsets) * newCap);
+		if (newOffsets == NULL)
+			return -1;
+		memcpy(newOffsets, column->offsets,
+				sizeof(*column->offsets) * column->numOffsets);
+	} else {
+		newOffsets = table_realloc(table, column->offsets,
+				sizeof(*column->offsets) * column->capOffsets,
+				sizeof(*column->offsets) * newCap);
+		if (newOffsets == NULL)
+			return -1;
 	}
+	column->offsets = newOffsets;
+	column->capOffsets = newCap;
+	return 0;
+}
 
-	if (n > 0) {
-		size_t lead, trail;
+/* Copies the cells of a column that borrows them from a mapping into
+ * storage owned by the column, so that cells can be added to it.
+ */
+static int table_owncolumn(Table *table, struct table_column *column)
+{
+	char *text;
+	size_t lenText, capText;
 
-		for (lead = 0; isblank(str[lead]); lead++);
-		for (trail = 0; isblank(str[n - 1 - trail]); trail++);
-		n -= lead + trail;
-		memmove(str, str + lead, n);
+	if (table_decodecolumn(table, column) < 0)
+		return -1;
+	if (column->capText > 0)
+		return 0;
+	lenText = 0;
+	for (size_t i = 0; i < column->numOffsets; i++)
+		if (column->offsets[i] != TABLE_EMPTY_CELL &&
+				!table_isinline(column->offsets[i]))
+			lenText += strlen(&column->text[column->offsets[i]]) + 1;
+	capText = lenText + 64;
+	text = table_realloc(table, NULL, 0, capText);
+	if (text == NULL)
+		return -1;
+	lenText = 0;
+	for (size_t i = 0; i < column->numOffsets; i++) {
+		const char *cell;
+		size_t length;
+
+		if (column->offsets[i] == TABLE_EMPTY_CELL ||
+				table_isinline(column->offsets[i]))
+			continue;
+		cell = &column->text[column->offsets[i]];
+		length = strlen(cell);
+		memcpy(&text[lenText], cell, length + 1);
+		column->offsets[i] = lenText;
+		lenText += length + 1;
 	}
-	newStr = table_realloc(table, str, n + 1);
-	if (newStr == NULL)
-		goto err;
-	str = newStr;
-	str[n] = '\0';
-	*pText = text;
-	return str;
+	column->text = text;
+	column->lenText = lenText;
+	column->capText = capText;
+	column->deadText = 0;
+	return 0;
+}
 
-err:
-	free(str);
-	return NULL;
+/* Appends a null terminated copy of the text to the column and returns
+ * its offset in *pOffset, short texts go into the offset itself.
+ */
+static int table_copytext(Table *table, struct table_column *column,
+		const char *text, size_t length, size_t *pOffset)
+{
+	if (table_owncolumn(table, column) < 0)
+		return -1;
+	if (length <= TABLE_INLINE_MAX) {
+		*pOffset = table_inlineoffset(text, length);
+		return 0;
+	}
+	if (column->lenText + length + 1 > column->capText) {
+		char *newText;
+		size_t newCap;
+
+		newCap = MAX(column->capText * 2,
+				column->lenText + length + 1);
+		newText = table_realloc(table, column->text, column->capText,
+				newCap);
+		if (newText == NULL)
+			return -1;
+		column->text = newText;
+		column->capText = newCap;
+	}
+	memcpy(&column->text[column->lenText], text, length);
+	column->text[column->lenText + length] = '\0';
+	*pOffset = column->lenText;
+	column->lenText += length + 1;
+	return 0;
 }
 
-static char **table_parse_row(Table *table, const char *text, size_t *pNumCols)
+struct table_move {
+	size_t offset;
+	size_t row;
+};
+
+static int table_compareoffsets(const void *a, const void *b)
 {
-	char *str;
-	char **row;
-	char **newRow;
-	size_t numCols;
+	const struct table_move *const moveA = a;
+	const struct table_move *const moveB = b;
 
-	row = NULL;
-	numCols = 0;
-	while (1) {
-		str = table_parse_string(table, text, &text);
-		if (str == NULL)
-			goto err;
-		newRow = table_realloc(table, row, sizeof(*row) *
-				(numCols + 1));
-		if (newRow == NULL)
-			goto err;
-		row = newRow;
-		row[numCols++] = str;
-		if (*text == '\0')
-			break;
-		if (*text != ';' && *text != ',' && *text != '\t') {
-			fprintf(stderr, "error: missing separator");
-			table->atText = text;
-			goto err;
+	return (moveA->offset > moveB->offset) -
+		(moveA->offset < moveB->offset);
+}
+
+/* Copies the cells that are still referred to into new text, cells that
+ * share their text keep sharing it. Without memory the column simply
+ * stays as it is.
+ */
+static void table_compacttext(Table *table, struct table_column *column)
+{
+	struct table_move *moves;
+	size_t numMoves = 0;
+	char *text;
+	size_t lenText = 0, capText;
+
+	moves = malloc(sizeof(*moves) * MAX(column->numOffsets, (size_t) 1));
+	if (moves == NULL)
+		return;
+	for (size_t i = 0; i < column->numOffsets; i++)
+		if (column->offsets[i] != TABLE_EMPTY_CELL &&
+				!table_isinline(column->offsets[i]))
+			moves[numMoves++] = (struct table_move) {
+				column->offsets[i], i
+			};
+	qsort(moves, numMoves, sizeof(*moves), table_compareoffsets);
+	for (size_t i = 0; i < numMoves; i++)
+		if (i == 0 || moves[i].offset != moves[i - 1].offset)
+			lenText += strlen(&column->text[moves[i].offset]) + 1;
+	capText = lenText + 64;
+	text = arena_alloc(&table->arena, capText);
+	if (text == NULL) {
+		free(moves);
+		return;
+	}
+	lenText = 0;
+	for (size_t i = 0, offset = 0; i < numMoves; i++) {
+		if (i == 0 || moves[i].offset != moves[i - 1].offset) {
+			const char *const cell =
+				&column->text[moves[i].offset];
+			const size_t length = strlen(cell);
+
+			memcpy(&text[lenText], cell, length + 1);
+			offset = lenText;
+			lenText += length + 1;
 		}
-		text++;
+		column->offsets[moves[i].row] = offset;
 	}
-	*pNumCols = numCols;
-	return row;
+	free(moves);
+	arena_free(&table->arena, column->text, column->capText);
+	column->text = text;
+	column->lenText = lenText;
+	column->capText = capText;
+	column->deadText = 0;
+}
 
-err:
-	for (size_t x = 0; x < numCols; x++)
-		free(row[x]);
-	free(row);
-	return NULL;
+/* Sets the cell at row, the column must not have any cell behind it,
+ * the cells in between are empty.
+ */
+static int table_pushcell(Table *table, struct table_column *column,
+		size_t row, size_t offset)
+{
+	if (column->type != TABLE_TYPE_UNKNOWN)
+		table_untype(table, column);
+	if (table_decodecolumn(table, column) < 0 ||
+			table_reservecells(table, column, row + 1) < 0)
+		return -1;
+	while (column->numOffsets < row)
+		column->offsets[column->numOffsets++] = TABLE_EMPTY_CELL;
+	column->offsets[column->numOffsets++] = offset;
+	return 0;
+}
+
+/* Drops the cells that were pushed for a row that could not be added. */
+static void table_droprows(Table *table)
+{
+	for (size_t i = 0; i < table->numCols; i++) {
+		struct table_column *const column = &table->columns[i];
+		column->numOffsets = MIN(column->numOffsets, table->numRows);
+	}
+	table->numLines = MIN(table->numLines, table->numRows);
+}
+
+static int table_setheader(Table *table, size_t numCols, bool inPlace)
+{
+	if (table_reservecols(table, numCols) < 0)
+		return -1;
+	for (size_t i = 0; i < numCols; i++) {
+		const struct table_slice *const slice = &table->slices[i];
+
+		if (inPlace) {
+			slice->start[slice->length] = '\0';
+			table->colNames[i] = slice->start;
+			continue;
+		}
+		table->colNames[i] = arena_strndup(&table->arena,
+				slice->start, slice->length);
+		if (table->colNames[i] == NULL) {
+			snprintf(table->error, sizeof(table->error),
+					"could not allocate %zu bytes: %s",
+					slice->length + 1, strerror(errno));
+			table->atText = NULL;
+			return -1;
+		}
+	}
+	table->numCols = numCols;
+	return 0;
+}
+
+/* Adds table->slices as a new row or as the column names if there are
+ * none yet. When inPlace is set, the slices are part of
+ * table->mappedText and are terminated in place, columns that do not
+ * own their cells then simply point into the mapping. This never
+ * overwrites the start of the next cell because there is always at
+ * least a separator or closing quote in between.
+ */
+static int table_appendrow(Table *table, size_t numCols, bool inPlace)
+{
+	if (table->colNames == NULL)
+		return table_setheader(table, numCols, inPlace);
+	if (numCols > table->numCols) {
+		snprintf(table->error, sizeof(table->error),
+				"too many cols (%zu vs %zu)",
+				numCols, table->numCols);
+		table->atText = NULL;
+		return -1;
+	}
+	if (table_reserverows(table, table->numRows + 1) < 0)
+		return -1;
+
+	/* short rows need no padding, the missing cells are empty */
+	for (size_t i = 0; i < numCols; i++) {
+		struct table_column *const column = &table->columns[i];
+		const struct table_slice *const slice = &table->slices[i];
+		size_t offset;
+
+		if (slice->length == 0) {
+			offset = TABLE_EMPTY_CELL;
+		} else if (inPlace && column->capText == 0 &&
+				(column->text == NULL ||
+				 column->text == table->mappedText)) {
+			slice->start[slice->length] = '\0';
+			column->text = table->mappedText;
+			offset = slice->start - table->mappedText;
+		} else if (table_copytext(table, column, slice->start,
+					slice->length, &offset) < 0) {
+			table_droprows(table);
+			return -1;
+		}
+		if (table_pushcell(table, column, table->numRows,
+					offset) < 0) {
+			table_droprows(table);
+			return -1;
+		}
+	}
+	table->numRows++;
+	return 0;
 }
 
 int table_parseline(Table *table, const char *text)
 {
-	char **row;
 	size_t numCols;
-	char ***newCells;
-	size_t *newActiveRows;
 
-	row = table_parse_row(table, text, &numCols);
-	if (row == NULL)
+	if (table_beginchange(table) < 0)
 		return -1;
-	if (table->colNames == NULL) {
-		table->colNames = row;
-		table->numCols = numCols;
-		table->activeCols = malloc(sizeof(*table->activeCols) *
-				table->numCols);
-		if (table->activeCols == NULL)
-			goto err;
-		table->newActiveCols = malloc(sizeof(*table->newActiveCols) *
-				table->numCols);
-		if (table->newActiveCols == NULL)
-			goto err;
-		return 0;
+	if (table_parse_row(table, text, strlen(text), &numCols) < 0)
+		return -1;
+	return table_appendrow(table, numCols, false);
+}
+
+int table_addmapping(Table *table, char *data, size_t size,
+		const struct stat *st)
+{
+	struct table_mapping *newMappings;
+
+	newMappings = table_realloc(table, table->mappings,
+			sizeof(*table->mappings) * table->numMappings,
+			sizeof(*table->mappings) * (table->numMappings + 1));
+	if (newMappings == NULL)
+		return -1;
+	table->mappings = newMappings;
+	table->mappings[table->numMappings].data = data;
+	table->mappings[table->numMappings].size = size;
+	table->mappings[table->numMappings].fd = -1;
+	table->mappings[table->numMappings].firstRow = table->numRows;
+	table->mappings[table->numMappings].dev = st->st_dev;
+	table->mappings[table->numMappings].ino = st->st_ino;
+	table->numMappings++;
+	table->mappedText = data;
+	return 0;
+}
+
+int table_parsemappedline(Table *table, char *line, size_t length)
+{
+	size_t numCols;
+	const bool hasHeader = table->colNames != NULL;
+
+	if (table_beginchange(table) < 0)
+		return -1;
+	/* parsing puts null bytes into the line */
+	if (table->quote == TABLE_QUOTE_KEEP && hasHeader &&
+			table_keepable(line, length) &&
+			table_keepline(table, table->numRows,
+				line - table->mappedText, length) < 0)
+		return -1;
+	if (table_parse_row(table, line, length, &numCols) < 0 ||
+			table_appendrow(table, numCols, true) < 0) {
+		table->numLines = MIN(table->numLines, table->numRows);
+		return -1;
+	}
+	return 0;
+}
+
+bool table_keepable(const char *line, size_t length)
+{
+	return memchr(line, ',', length) == NULL &&
+		memchr(line, '\t', length) == NULL;
+}
+
+int table_keepline(Table *table, size_t row, size_t start, size_t length)
+{
+	if (row >= table->capLines) {
+		struct table_line *newLines;
+		size_t newCap;
+
+		newCap = MAX(row + 1, table->capLines * 2 + 1024);
+		newLines = table_realloc(table, table->lines,
+				sizeof(*table->lines) * table->capLines,
+				sizeof(*table->lines) * newCap);
+		if (newLines == NULL)
+			return -1;
+		table->lines = newLines;
+		table->capLines = newCap;
 	}
+	while (table->numLines < row)
+		table->lines[table->numLines++].start = TABLE_NO_LINE;
+	table->lines[row].start = start;
+	table->lines[row].length = length;
+	table->numLines = MAX(table->numLines, row + 1);
+	return 0;
+}
+
+/* shared by all cells that are padded onto rows that are too short */
+static Utf8 table_emptycell[1];
+
+int table_splitline(Table *table, char *line, size_t length, Utf8 **row)
+{
+	size_t numCols;
+
+	if (table_parse_row(table, line, length, &numCols) < 0)
+		return -1;
 	if (numCols > table->numCols) {
-		fprintf(stderr, "error: too many cols (%zu vs %zu)",
-			numCols, table->numCols);
-		goto err;
+		snprintf(table->error, sizeof(table->error),
+				"too many cols (%zu vs %zu)",
+				numCols, table->numCols);
+		table->atText = NULL;
+		return -1;
+	}
+	for (size_t i = 0; i < numCols; i++) {
+		const struct table_slice *const slice = &table->slices[i];
+		slice->start[slice->length] = '\0';
+		row[i] = slice->start;
 	}
-	if (numCols < table->numCols) {
-		char **paddedRow;
+	for (size_t i = numCols; i < table->numCols; i++)
+		row[i] = table_emptycell;
+	return 0;
+}
 
-		paddedRow = realloc(row, sizeof(*row) * table->numCols);
-		if (paddedRow == NULL)
-			goto err;
-		row = paddedRow;
-		/* setting all to NULL to never get free(trashpointer) */
-		for (size_t i = numCols; i < table->numCols; i++)
-			row[i] = NULL;
-		for (size_t i = numCols; i < table->numCols; i++) {
-			row[i] = malloc(1);
-			if (row[i] == NULL)
+int table_setcell(Table *table, size_t row, size_t col, const Utf8 *text)
+{
+	struct table_column *const column = &table->columns[col];
+	size_t offset;
+
+	const size_t length = strlen(text);
+	if (table_beginchange(table) < 0)
+		return -1;
+	table_touchindex(table, row);
+	table_freehash(column);
+	if (length == 0)
+		offset = TABLE_EMPTY_CELL;
+	else if (table_copytext(table, column, text, length, &offset) < 0)
+		return -1;
+	if (column->type != TABLE_TYPE_UNKNOWN)
+		table_untype(table, column);
+	if (table_decodecolumn(table, column) < 0)
+		return -1;
+	if (row < table->numLines)
+		table->lines[row].start = TABLE_NO_LINE;
+	if (row < column->numOffsets) {
+		const size_t oldOffset = column->offsets[row];
+
+		/* borrowed text belongs to the mapping */
+		if (column->capText > 0 && oldOffset != TABLE_EMPTY_CELL &&
+				!table_isinline(oldOffset))
+			column->deadText +=
+				strlen(&column->text[oldOffset]) + 1;
+		column->offsets[row] = offset;
+		if (column->deadText >= TABLE_COMPACT_MIN &&
+				column->deadText >= column->lenText / 2)
+			table_compacttext(table, column);
+		return 0;
+	}
+	return table_pushcell(table, column, row, offset);
+}
+
+int table_takerows(Table *table, Table *from)
+{
+	if (table_beginchange(table) < 0)
+		return -1;
+	const size_t numRows = table->numRows + from->numRows;
+	if (table_reserverows(table, numRows) < 0)
+		return -1;
+	for (size_t i = 0; i < table->numCols; i++) {
+		struct table_column *const column = &table->columns[i];
+		struct table_column *const other = &from->columns[i];
+
+		if (other->numOffsets == 0)
+			continue;
+		/* both borrow from the same mapping, only the offsets need
+		 * to be moved
+		 */
+		if (column->capText == 0 && other->capText == 0 &&
+				(column->text == NULL ||
+				 column->text == other->text)) {
+			if (column->type != TABLE_TYPE_UNKNOWN)
+				table_untype(table, column);
+			if (table_reservecells(table, column, table->numRows +
+						other->numOffsets) < 0)
 				goto err;
-			row[i][0] = '\0';
+			while (column->numOffsets < table->numRows)
+				column->offsets[column->numOffsets++] =
+					TABLE_EMPTY_CELL;
+			memcpy(&column->offsets[column->numOffsets],
+					other->offsets,
+					sizeof(*other->offsets) *
+						other->numOffsets);
+			column->numOffsets += other->numOffsets;
+			column->text = other->text;
+			continue;
 		}
-	}
-	newCells = table_realloc(table, table->cells, sizeof(*table->cells) *
-			(table->numRows + 1));
-	if (newCells == NULL)
-		goto err;
-	table->cells = newCells;
-	table->cells[table->numRows++] = row;
+		for (size_t j = 0; j < other->numOffsets; j++) {
+			size_t offset = other->offsets[j];
 
-	newActiveRows = realloc(table->activeRows,
-			sizeof(*table->activeRows) * table->numRows);
-	if (newActiveRows == NULL)
-		goto err;
-	table->activeRows = newActiveRows;
+			if (offset != TABLE_EMPTY_CELL &&
+					!table_isinline(offset)) {
+				const char *const cell = &other->text[offset];
+				if (table_copytext(table, column, cell,
+						strlen(cell), &offset) < 0)
+					goto err;
+			}
+			if (table_pushcell(table, column, table->numRows + j,
+						offset) < 0)
+				goto err;
+		}
+	}
+	if (from->numLines > 0) {
+		/* makes room, the lines are then copied over */
+		if (table_keepline(table, table->numRows + from->numLines - 1,
+					0, 0) < 0)
+			goto err;
+		memcpy(&table->lines[table->numRows], from->lines,
+				sizeof(*from->lines) * from->numLines);
+	}
+	table->numRows = numRows;
 
-	newActiveRows = realloc(table->newActiveRows,
-			sizeof(*table->newActiveRows) * table->numRows);
-	if (newActiveRows == NULL)
-		goto err;
-	table->newActiveRows = newActiveRows;
+	/* only the cell texts stay, the rest is given back before the
+	 * memory changes owner
+	 */
+	for (size_t i = 0; i < from->numCols; i++)
+		arena_free(&from->arena, from->columns[i].offsets,
+				sizeof(*from->columns[i].offsets) *
+					from->columns[i].capOffsets);
+	arena_free(&from->arena, from->columns,
+			sizeof(*from->columns) * from->capCols);
+	arena_free(&from->arena, from->activeRows,
+			sizeof(*from->activeRows) * from->capRows);
+	arena_free(&from->arena, from->rowSet,
+			sizeof(*from->rowSet) * TABLE_SET_WORDS(from->capRows));
+	arena_free(&from->arena, from->newRowSet,
+			sizeof(*from->newRowSet) *
+				TABLE_SET_WORDS(from->capRows));
+	arena_free(&from->arena, from->slices,
+			sizeof(*from->slices) * from->capSlices);
+	arena_free(&from->arena, from->lines,
+			sizeof(*from->lines) * from->capLines);
+	arena_merge(&table->arena, &from->arena);
+	table_init(from);
 	return 0;
 
 err:
-	table_uninit(table);
+	table_droprows(table);
 	return -1;
 }
 
-void table_uninit(Table *table)
+int table_appendcol(Table *table, const Utf8 *name)
 {
-	for (size_t x = 0; x < table->numCols; x++)
-		free(table->colNames[x]);
-	for (size_t y = 0; y < table->numRows; y++) {
-		for (size_t x = 0; x < table->numCols; x++)
-			free(table->cells[y][x]);
-		free(table->cells[y]);
+	Utf8 *newName;
+
+	if (table_beginchange(table) < 0)
+		return -1;
+	/* the new column has no cells, they all read as empty */
+	if (table_reservecols(table, table->numCols + 1) < 0)
+		return -1;
+	newName = arena_strndup(&table->arena, name, strlen(name));
+	if (newName == NULL) {
+		snprintf(table->error, sizeof(table->error),
+				"could not allocate %zu bytes: %s",
+				strlen(name) + 1, strerror(errno));
+		table->atText = NULL;
+		return -1;
 	}
-	free(table->colNames);
-	free(table->cells);
-	free(table->activeRows);
-	free(table->activeCols);
-	free(table->newActiveRows);
-	free(table->newActiveCols);
+	table->colNames[table->numCols++] = newName;
+	/* no row is as it was read anymore */
+	table->numLines = 0;
+	return 0;
 }
 
+void table_uninit(Table *table)
+{
+	table_freeindex(table);
+	for (size_t i = 0; i < table->numCols; i++)
+		table_freehash(&table->columns[i]);
+	table_uninitlazy(table);
+	for (size_t i = 0; i < table->numMappings; i++) {
+		munmap(table->mappings[i].data, table->mappings[i].size);
+		if (table->mappings[i].fd >= 0)
+			close(table->mappings[i].fd);
+	}
+	table_clearhistory(table);
+	free(table->history);
+	table_clearresults(table);
+	if (table->spillFile != NULL)
+		fclose(table->spillFile);
+	arena_release(&table->arena);
+}
@@ -0,0 +1,324 @@
+#include "tabular.h"
+
+/* A snapshot is stored next to the file it was made of and looks like
+ * this, all numbers are in the byte order of the machine that wrote it:
+ *   struct table_cache_header
+ *   struct table_cache_column[numCols]
+ *   the null terminated column names
+ *   for each column: its text, padded to 8 bytes, then its offsets
+ * The offsets are relative to the text of their column, so a column
+ * can borrow both straight from the mapping.
+ */
+#define TABLE_CACHE_MAGIC "TABCACHE"
+#define TABLE_CACHE_VERSION 2
+#define TABLE_CACHE_BYTE_ORDER 0x01020304
+#define TABLE_CACHE_SUFFIX ".tabcache"
+
+struct table_cache_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t byteOrder;
+	/* the file the snapshot was made of */
+	uint64_t sourceSize;
+	int64_t sourceSec;
+	int64_t sourceNsec;
+	uint64_t numRows;
+	uint64_t numCols;
+	/* of the header, with this set to 0, and the columns */
+	uint64_t checksum;
+};
+
+/* all positions are from the start of the snapshot */
+struct table_cache_column {
+	uint64_t name;
+	uint64_t text;
+	uint64_t lenText;
+	uint64_t offsets;
+	uint64_t numOffsets;
+};
+
+static char *table_cachepath(const char *path, const char *suffix)
+{
+	char *cachePath;
+
+	const size_t len = strlen(path);
+	const size_t lenSuffix = strlen(suffix);
+	cachePath = malloc(len + lenSuffix + 1);
+	if (cachePath == NULL)
+		return NULL;
+	memcpy(cachePath, path, len);
+	memcpy(&cachePath[len], suffix, lenSuffix + 1);
+	return cachePath;
+}
+
+static uint64_t table_checksum(uint64_t hash, const void *data, size_t size)
+{
+	const unsigned char *const bytes = data;
+
+	/* FNV-1a */
+	for (size_t i = 0; i < size; i++) {
+		hash ^= bytes[i];
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+static uint64_t table_checkheader(const struct table_cache_header *header,
+		const struct table_cache_column *columns)
+{
+	struct table_cache_header copy;
+
+	copy = *header;
+	copy.checksum = 0;
+	return table_checksum(table_checksum(0xcbf29ce484222325,
+				&copy, sizeof(copy)), columns,
+			sizeof(*columns) * header->numCols);
+}
+
+/* Nothing in the snapshot is trusted, every position and every offset
+ * has to stay within the mapping and cells within their column.
+ */
+static bool table_validcache(const char *data, size_t size,
+		const struct stat *st)
+{
+	const struct table_cache_header *header;
+	const struct table_cache_column *columns;
+
+	if (size < sizeof(*header))
+		return false;
+	header = (const struct table_cache_header*) data;
+	if (memcmp(header->magic, TABLE_CACHE_MAGIC, sizeof(header->magic)) ||
+			header->version != TABLE_CACHE_VERSION ||
+			header->byteOrder != TABLE_CACHE_BYTE_ORDER ||
+			sizeof(size_t) != sizeof(uint64_t))
+		return false;
+	if (header->sourceSize != (uint64_t) st->st_size ||
+			header->sourceSec != (int64_t) st->st_mtim.tv_sec ||
+			header->sourceNsec != (int64_t) st->st_mtim.tv_nsec)
+		return false;
+	if (header->numCols == 0 || header->numCols >
+			(size - sizeof(*header)) / sizeof(*columns))
+		return false;
+	columns = (const struct table_cache_column*) &header[1];
+	if (header->checksum != table_checkheader(header, columns))
+		return false;
+	for (size_t i = 0; i < header->numCols; i++) {
+		const struct table_cache_column *const column = &columns[i];
+		const uint64_t *offsets;
+
+		if (column->name >= size || memchr(&data[column->name], '\0',
+					size - column->name) == NULL)
+			return false;
+		if (column->text > size || column->lenText >
+				size - column->text)
+			return false;
+		if (column->lenText > 0 &&
+				data[column->text + column->lenText - 1] != '\0')
+			return false;
+		if (column->offsets % sizeof(uint64_t) != 0 ||
+				column->offsets > size ||
+				column->numOffsets > header->numRows ||
+				column->numOffsets > (size - column->offsets) /
+					sizeof(uint64_t))
+			return false;
+		/* the text ends in a null byte, so any offset before its
+		 * end is a terminated cell
+		 */
+		offsets = (const uint64_t*) &data[column->offsets];
+		for (size_t j = 0; j < column->numOffsets; j++)
+			if (offsets[j] != TABLE_EMPTY_CELL &&
+					offsets[j] >= column->lenText)
+				return false;
+	}
+	return true;
+}
+
+int table_loadcache(Table *table, const char *path, const struct stat *st)
+{
+	char *cachePath;
+	int fd;
+	struct stat cacheSt;
+	char *data;
+	size_t size;
+	const struct table_cache_header *header;
+	const struct table_cache_column *columns;
+
+	cachePath = table_cachepath(path, TABLE_CACHE_SUFFIX);
+	if (cachePath == NULL)
+		return 1;
+	fd = open(cachePath, O_RDONLY);
+	free(cachePath);
+	if (fd < 0)
+		return 1;
+	if (fstat(fd, &cacheSt) < 0 || cacheSt.st_size <= 0) {
+		close(fd);
+		return 1;
+	}
+	size = cacheSt.st_size;
+	/* private and writable like the mapped files, so that borrowed
+	 * offsets can be changed in place
+	 */
+	data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (data == MAP_FAILED)
+		return 1;
+	if (!table_validcache(data, size, st)) {
+		munmap(data, size);
+		return 1;
+	}
+	if (table_addmapping(table, data, size, &cacheSt) < 0) {
+		munmap(data, size);
+		fprintf(stderr, "error: %s\n", table_strerror(table));
+		return -1;
+	}
+
+	header = (const struct table_cache_header*) data;
+	columns = (const struct table_cache_column*) &header[1];
+	if (table_reservecols(table, header->numCols) < 0 ||
+			table_reserverows(table, header->numRows) < 0) {
+		fprintf(stderr, "error: %s\n", table_strerror(table));
+		return -1;
+	}
+	for (size_t i = 0; i < header->numCols; i++) {
+		struct table_column *const column = &table->columns[i];
+
+		table->colNames[i] = &data[columns[i].name];
+		column->text = &data[columns[i].text];
+		column->lenText = columns[i].lenText;
+		column->capText = 0;
+		column->deadText = 0;
+		column->offsets = (size_t*) &data[columns[i].offsets];
+		column->numOffsets = columns[i].numOffsets;
+		column->capOffsets = 0;
+	}
+	table->numCols = header->numCols;
+	table->numRows = header->numRows;
+	return 0;
+}
+
+static bool table_writepadding(FILE *fp, uint64_t *pPos)
+{
+	static const char zeros[sizeof(uint64_t)];
+
+	const size_t pad = -*pPos % sizeof(uint64_t);
+	*pPos += pad;
+	return fwrite(zeros, 1, pad, fp) == pad;
+}
+
+int table_savecache(Table *table, const char *path, const struct stat *st)
+{
+	char *cachePath = NULL, *tmpPath = NULL;
+	int fd;
+	FILE *fp = NULL;
+	struct table_cache_header header;
+	struct table_cache_column *columns = NULL;
+	size_t *offsets = NULL;
+	uint64_t pos;
+	bool ok = false;
+
+	cachePath = table_cachepath(path, TABLE_CACHE_SUFFIX);
+	tmpPath = table_cachepath(path, TABLE_CACHE_SUFFIX ".XXXXXX");
+	columns = calloc(table->numCols, sizeof(*columns));
+	offsets = malloc(sizeof(*offsets) * MAX(table->numRows, (size_t) 1));
+	if (cachePath == NULL || tmpPath == NULL || columns == NULL ||
+			offsets == NULL)
+		goto end;
+	/* written under another name first so that a reader never sees
+	 * half of a snapshot, the name is made up in the same directory
+	 * so that nobody can put a file or link there in advance
+	 */
+	fd = mkstemp(tmpPath);
+	if (fd < 0)
+		goto end;
+	/* readable by whoever can read the file it holds the cells of */
+	fchmod(fd, st->st_mode & 0666);
+	fp = fdopen(fd, "wb");
+	if (fp == NULL) {
+		close(fd);
+		unlink(tmpPath);
+		goto end;
+	}
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, TABLE_CACHE_MAGIC, sizeof(header.magic));
+	header.version = TABLE_CACHE_VERSION;
+	header.byteOrder = TABLE_CACHE_BYTE_ORDER;
+	header.sourceSize = st->st_size;
+	header.sourceSec = st->st_mtim.tv_sec;
+	header.sourceNsec = st->st_mtim.tv_nsec;
+	header.numRows = table->numRows;
+	header.numCols = table->numCols;
+	if (fwrite(&header, sizeof(header), 1, fp) != 1 ||
+			fwrite(columns, sizeof(*columns), table->numCols,
+				fp) != table->numCols)
+		goto end;
+	pos = sizeof(header) + sizeof(*columns) * table->numCols;
+
+	for (size_t i = 0; i < table->numCols; i++) {
+		const size_t len = strlen(table->colNames[i]) + 1;
+		if (fwrite(table->colNames[i], 1, len, fp) != len)
+			goto end;
+		columns[i].name = pos;
+		pos += len;
+	}
+
+	/* the cells are written compactly, borrowed columns have the
+	 * whole file as their text
+	 */
+	for (size_t i = 0; i < table->numCols; i++) {
+		const struct table_column *const column = &table->columns[i];
+		uint64_t lenText = 0;
+
+		for (size_t j = 0; j < column->numOffsets; j++) {
+			const char *const cell = table_getcell(table, j, i);
+			size_t len;
+
+			if (*cell == '\0') {
+				offsets[j] = TABLE_EMPTY_CELL;
+				continue;
+			}
+			len = strlen(cell) + 1;
+			if (fwrite(cell, 1, len, fp) != len)
+				goto end;
+			offsets[j] = lenText;
+			lenText += len;
+		}
+		columns[i].text = pos;
+		columns[i].lenText = lenText;
+		pos += lenText;
+		if (!table_writepadding(fp, &pos))
+			goto end;
+		columns[i].offsets = pos;
+		columns[i].numOffsets = column->numOffsets;
+		if (fwrite(offsets, sizeof(*offsets), column->numOffsets,
+					fp) != column->numOffsets)
+			goto end;
+		pos += sizeof(*offsets) * column->numOffsets;
+	}
+
+	header.checksum = table_checkheader(&header, columns);
+	if (fseek(fp, 0, SEEK_SET) < 0 ||
+			fwrite(&header, sizeof(header), 1, fp) != 1 ||
+			fwrite(columns, sizeof(*columns), table->numCols,
+				fp) != table->numCols)
+		goto end;
+	ok = true;
+
+end:
+	if (fp != NULL && fclose(fp) != 0)
+		ok = false;
+	if (ok && rename(tmpPath, cachePath) < 0)
+		ok = false;
+	if (!ok) {
+		fprintf(stderr, "error: unable to write cache '%s': %s\n",
+				cachePath == NULL ? path : cachePath,
+				strerror(errno));
+		if (fp != NULL)
+			unlink(tmpPath);
+	}
+	free(offsets);
+	free(columns);
+	free(tmpPath);
+	free(cachePath);
+	return ok ? 0 : -1;
+}
@@ -0,0 +1,256 @@
+#include "tabular.h"
+
+/* Columns with fewer cells are not worth encoding */
+#define TABLE_DICT_MIN_CELLS ((size_t) 1024)
+/* A column is only encoded when it has at most one distinct cell for
+ * this many cells, so that the codes and the dictionary together are
+ * much smaller than the offsets.
+ */
+#define TABLE_DICT_RATIO ((size_t) 8)
+/* The ratio is checked early after this many cells, so that columns
+ * of unique cells are given up on quickly.
+ */
+#define TABLE_DICT_SAMPLE ((size_t) 4096)
+
+/* Open addressing hash set of the distinct cells of a column, each
+ * slot holds the code of a cell plus one, or 0 when it is free.
+ */
+struct table_dict_set {
+	uint32_t *slots;
+	size_t capSlots;
+};
+
+static size_t table_hashcell(const char *cell)
+{
+	/* FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for (; *cell != '\0'; cell++) {
+		hash ^= (unsigned char) *cell;
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+static const char *table_dictcell(const char *text, size_t offset)
+{
+	return offset == TABLE_EMPTY_CELL ? "" : &text[offset];
+}
+
+static int table_growset(struct table_dict_set *set, const char *text,
+		const size_t *dict)
+{
+	uint32_t *newSlots;
+	size_t newCap;
+
+	newCap = set->capSlots == 0 ? 1024 : set->capSlots * 2;
+	newSlots = calloc(newCap, sizeof(*newSlots));
+	if (newSlots == NULL)
+		return -1;
+	for (size_t i = 0; i < set->capSlots; i++) {
+		size_t slot;
+
+		if (set->slots[i] == 0)
+			continue;
+		slot = table_hashcell(table_dictcell(text,
+					dict[set->slots[i] - 1]));
+		while (newSlots[slot & (newCap - 1)] != 0)
+			slot++;
+		newSlots[slot & (newCap - 1)] = set->slots[i];
+	}
+	free(set->slots);
+	set->slots = newSlots;
+	set->capSlots = newCap;
+	return 0;
+}
+
+/* Replaces the offsets of the column by codes into a dictionary of its
+ * distinct cells. Returns 1 when the column has too many distinct cells
+ * to be encoded.
+ */
+static int table_encodecolumn(Table *table, struct table_column *column)
+{
+	const size_t numCells = column->numOffsets;
+	const size_t maxDict = MIN(numCells / TABLE_DICT_RATIO,
+			(size_t) UINT32_MAX - 1);
+	struct table_dict_set set = { NULL, 0 };
+	uint32_t *codes;
+	size_t *dict = NULL;
+	size_t numDict = 0, capDict = 0;
+	char *text = NULL;
+	size_t lenText = 0, capText = 0;
+	void *packed;
+	size_t *newDict;
+	char *newText;
+	size_t codeSize;
+	int code = -1;
+
+	codes = malloc(sizeof(*codes) * numCells);
+	if (codes == NULL)
+		goto end;
+	for (size_t row = 0; row < numCells; row++) {
+		const size_t offset = column->offsets[row];
+		const char *const cell = table_offsetcell(column->text,
+				&column->offsets[row]);
+		size_t slot;
+
+		if (row == TABLE_DICT_SAMPLE &&
+				numDict > TABLE_DICT_SAMPLE / TABLE_DICT_RATIO) {
+			code = 1;
+			goto end;
+		}
+		if (numDict * 2 >= set.capSlots &&
+				table_growset(&set, text, dict) < 0)
+			goto end;
+		slot = table_hashcell(cell);
+		while (set.slots[slot & (set.capSlots - 1)] != 0) {
+			const size_t index =
+				set.slots[slot & (set.capSlots - 1)] - 1;
+			if (!strcmp(table_dictcell(text, dict[index]), cell))
+				break;
+			slot++;
+		}
+		slot &= set.capSlots - 1;
+		if (set.slots[slot] != 0) {
+			codes[row] = set.slots[slot] - 1;
+			continue;
+		}
+
+		if (numDict == maxDict) {
+			code = 1;
+			goto end;
+		}
+		if (numDict == capDict) {
+			size_t *grownDict;
+
+			capDict = capDict * 2 + 64;
+			grownDict = realloc(dict, sizeof(*dict) * capDict);
+			if (grownDict == NULL)
+				goto end;
+			dict = grownDict;
+		}
+		if (offset == TABLE_EMPTY_CELL) {
+			dict[numDict] = TABLE_EMPTY_CELL;
+		} else {
+			const size_t length = strlen(cell);
+			if (lenText + length + 1 > capText) {
+				char *grownText;
+
+				capText = MAX(capText * 2, lenText + length + 1);
+				grownText = realloc(text, capText);
+				if (grownText == NULL)
+					goto end;
+				text = grownText;
+			}
+			memcpy(&text[lenText], cell, length + 1);
+			dict[numDict] = lenText;
+			lenText += length + 1;
+		}
+		set.slots[slot] = ++numDict;
+		codes[row] = numDict - 1;
+	}
+
+	/* the packed codes, the dictionary and its text go into the arena */
+	codeSize = numDict <= UINT8_MAX + 1 ? 1 :
+		numDict <= UINT16_MAX + 1 ? 2 : 4;
+	packed = arena_alloc(&table->arena, codeSize * numCells);
+	newDict = arena_alloc(&table->arena, sizeof(*dict) * numDict);
+	newText = arena_alloc(&table->arena, MAX(lenText, (size_t) 1));
+	if (packed == NULL || newDict == NULL || newText == NULL) {
+		arena_free(&table->arena, packed, codeSize * numCells);
+		arena_free(&table->arena, newDict, sizeof(*dict) * numDict);
+		arena_free(&table->arena, newText, MAX(lenText, (size_t) 1));
+		goto end;
+	}
+	for (size_t row = 0; row < numCells; row++)
+		switch (codeSize) {
+		case 1:
+			((uint8_t*) packed)[row] = codes[row];
+			break;
+		case 2:
+			((uint16_t*) packed)[row] = codes[row];
+			break;
+		default:
+			((uint32_t*) packed)[row] = codes[row];
+		}
+	memcpy(newDict, dict, sizeof(*dict) * numDict);
+	memcpy(newText, text, lenText);
+
+	if (column->capText > 0)
+		arena_free(&table->arena, column->text, column->capText);
+	if (column->capOffsets > 0)
+		arena_free(&table->arena, column->offsets,
+				sizeof(*column->offsets) * column->capOffsets);
+	column->text = newText;
+	column->lenText = lenText;
+	column->capText = MAX(lenText, (size_t) 1);
+	column->deadText = 0;
+	column->offsets = NULL;
+	column->capOffsets = 0;
+	column->codes = packed;
+	column->codeSize = codeSize;
+	column->dict = newDict;
+	column->numDict = numDict;
+	code = 0;
+
+end:
+	if (code < 0) {
+		snprintf(table->error, sizeof(table->error),
+				"could not encode a column: %s",
+				strerror(errno));
+		table->atText = NULL;
+	}
+	free(text);
+	free(dict);
+	free(set.slots);
+	free(codes);
+	return code;
+}
+
+int table_encodecolumns(Table *table)
+{
+	if (table->lazy != NULL)
+		return 0;
+	for (size_t i = 0; i < table->numCols; i++) {
+		struct table_column *const column = &table->columns[i];
+
+		if (column->codes != NULL ||
+				column->numOffsets < TABLE_DICT_MIN_CELLS)
+			continue;
+		if (table_encodecolumn(table, column) < 0)
+			return -1;
+	}
+	return 0;
+}
+
+int table_decodecolumn(Table *table, struct table_column *column)
+{
+	size_t *offsets;
+	size_t capOffsets;
+
+	if (column->codes == NULL)
+		return 0;
+	capOffsets = column->numOffsets + 64;
+	offsets = arena_alloc(&table->arena, sizeof(*offsets) * capOffsets);
+	if (offsets == NULL) {
+		snprintf(table->error, sizeof(table->error),
+				"could not allocate %zu bytes: %s",
+				sizeof(*offsets) * capOffsets, strerror(errno));
+		table->atText = NULL;
+		return -1;
+	}
+	for (size_t row = 0; row < column->numOffsets; row++)
+		offsets[row] = column->dict[table_getcode(column, row)];
+	arena_free(&table->arena, column->codes,
+			column->codeSize * column->numOffsets);
+	arena_free(&table->arena, column->dict,
+			sizeof(*column->dict) * column->numDict);
+	/* the text stays, the dictionary is the compact copy of it */
+	column->offsets = offsets;
+	column->capOffsets = capOffsets;
+	column->codes = NULL;
+	column->codeSize = 0;
+	column->dict = NULL;
+	column->numDict = 0;
+	return 0;
+}
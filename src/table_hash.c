@@ -0,0 +1,278 @@
+#include "tabular.h"
+
+/* The rows of each distinct cell of a column */
+struct table_hash {
+	/* open addressing, each slot holds the index of an entry plus one
+	 * or 0 when it is free
+	 */
+	size_t *slots;
+	size_t capSlots;
+	struct table_hash_entry {
+		/* offset of the cell in text */
+		size_t cell;
+		/* the rows in ascending order, the first one is kept apart
+		 * since most cells of a column with many distinct cells
+		 * only occur once
+		 */
+		size_t first;
+		size_t *rows;
+		size_t numRows;
+		size_t capRows;
+	} *entries;
+	size_t numEntries;
+	size_t capEntries;
+	/* copies of the cells, the column might move its own */
+	char *text;
+	size_t lenText;
+	size_t capText;
+	/* the rows from 0 on that were added */
+	size_t numRows;
+};
+
+static size_t table_hashtext(const char *text)
+{
+	/* FNV-1a */
+	uint64_t hash = 0xcbf29ce484222325;
+
+	for (; *text != '\0'; text++) {
+		hash ^= (unsigned char) *text;
+		hash *= 0x100000001b3;
+	}
+	return hash;
+}
+
+void table_freehash(struct table_column *column)
+{
+	struct table_hash *const hash = column->hash;
+
+	column->searched = false;
+	if (hash == NULL)
+		return;
+	for (size_t i = 0; i < hash->numEntries; i++)
+		free(hash->entries[i].rows);
+	free(hash->entries);
+	free(hash->slots);
+	free(hash->text);
+	free(hash);
+	column->hash = NULL;
+}
+
+/* Grows the slots so that numEntries entries leave half of them free */
+static int table_growslots(struct table_hash *hash, size_t numEntries)
+{
+	size_t *newSlots;
+	size_t newCap;
+
+	newCap = hash->capSlots == 0 ? 1024 : hash->capSlots * 2;
+	while (newCap < numEntries * 2)
+		newCap *= 2;
+	newSlots = calloc(newCap, sizeof(*newSlots));
+	if (newSlots == NULL)
+		return -1;
+	for (size_t i = 0; i < hash->numEntries; i++) {
+		size_t slot;
+
+		slot = table_hashtext(&hash->text[hash->entries[i].cell]);
+		while (newSlots[slot & (newCap - 1)] != 0)
+			slot++;
+		newSlots[slot & (newCap - 1)] = i + 1;
+	}
+	free(hash->slots);
+	hash->slots = newSlots;
+	hash->capSlots = newCap;
+	return 0;
+}
+
+/* Returns the entry of the cell, NULL if there is none. The slot where
+ * it would go is put into pSlot.
+ */
+static struct table_hash_entry *table_findcell(const struct table_hash *hash,
+		const char *cell, size_t *pSlot)
+{
+	size_t slot;
+
+	if (hash->capSlots == 0) {
+		*pSlot = 0;
+		return NULL;
+	}
+	slot = table_hashtext(cell);
+	for (;; slot++) {
+		const size_t index = hash->slots[slot & (hash->capSlots - 1)];
+
+		if (index == 0) {
+			*pSlot = slot & (hash->capSlots - 1);
+			return NULL;
+		}
+		if (!strcmp(&hash->text[hash->entries[index - 1].cell], cell))
+			return &hash->entries[index - 1];
+	}
+}
+
+static struct table_hash_entry *table_addcell(struct table_hash *hash,
+		const char *cell)
+{
+	struct table_hash_entry *entry;
+	size_t slot;
+	size_t length;
+
+	if (hash->numEntries * 2 >= hash->capSlots &&
+			table_growslots(hash, hash->numEntries + 1) < 0)
+		return NULL;
+	entry = table_findcell(hash, cell, &slot);
+	if (entry != NULL)
+		return entry;
+
+	if (hash->numEntries == hash->capEntries) {
+		struct table_hash_entry *newEntries;
+
+		hash->capEntries = hash->capEntries * 2 + 64;
+		newEntries = realloc(hash->entries, sizeof(*newEntries) *
+				hash->capEntries);
+		if (newEntries == NULL)
+			return NULL;
+		hash->entries = newEntries;
+	}
+	length = strlen(cell);
+	if (hash->lenText + length + 1 > hash->capText) {
+		char *newText;
+		size_t newCap;
+
+		newCap = MAX(hash->capText * 2, hash->lenText + length + 1);
+		newText = realloc(hash->text, newCap);
+		if (newText == NULL)
+			return NULL;
+		hash->text = newText;
+		hash->capText = newCap;
+	}
+	memcpy(&hash->text[hash->lenText], cell, length + 1);
+	entry = &hash->entries[hash->numEntries];
+	entry->cell = hash->lenText;
+	entry->first = SIZE_MAX;
+	entry->rows = NULL;
+	entry->numRows = 0;
+	entry->capRows = 0;
+	hash->lenText += length + 1;
+	hash->slots[slot] = ++hash->numEntries;
+	return entry;
+}
+
+/* Adds the rows that were added to the table since the column was
+ * hashed, a hash of more rows than the table has is made again.
+ */
+static int table_updatehash(Table *table, struct table_column *column,
+		size_t col)
+{
+	struct table_hash *hash = column->hash;
+
+	if (hash != NULL && hash->numRows > table->numRows)
+		table_freehash(column);
+	if (column->hash == NULL) {
+		column->hash = calloc(1, sizeof(*column->hash));
+		if (column->hash == NULL)
+			return -1;
+	}
+	hash = column->hash;
+	/* at most one entry per row, growing the slots as they fill
+	 * would hash every entry again several times
+	 */
+	if ((hash->numEntries + table->numRows - hash->numRows) * 2 >
+				hash->capSlots && table_growslots(hash,
+				hash->numEntries + table->numRows -
+				hash->numRows) < 0)
+		goto err;
+	for (; hash->numRows < table->numRows; hash->numRows++) {
+		struct table_hash_entry *entry;
+
+		entry = table_addcell(hash, table_getcell(table,
+					hash->numRows, col));
+		if (entry == NULL)
+			goto err;
+		if (entry->first == SIZE_MAX) {
+			entry->first = hash->numRows;
+			continue;
+		}
+		if (entry->numRows == entry->capRows) {
+			size_t *newRows;
+
+			entry->capRows = entry->capRows * 2 + 4;
+			newRows = realloc(entry->rows, sizeof(*newRows) *
+					entry->capRows);
+			if (newRows == NULL)
+				goto err;
+			entry->rows = newRows;
+		}
+		entry->rows[entry->numRows++] = hash->numRows;
+	}
+	return 0;
+
+err:
+	table_freehash(column);
+	return -1;
+}
+
+int table_hashrows(Table *table, const Pattern *pattern,
+		const size_t *cols, size_t numCols,
+		const size_t *rows, size_t numRows, uint64_t *set)
+{
+	uint64_t *found;
+
+	if (table->lazy != NULL)
+		return 1;
+	for (size_t i = 0; i < pattern->numAlternatives; i++)
+		if (pattern->alternatives[i].kind != PATTERN_EXACT &&
+				pattern->alternatives[i].kind != PATTERN_NONE)
+			return 1;
+	/* the cells are scanned the first time, a column that is never
+	 * searched again is not worth hashing
+	 */
+	for (size_t i = 0; i < numCols; i++) {
+		struct table_column *const column = &table->columns[cols[i]];
+
+		if (column->hash == NULL && !column->searched) {
+			for (size_t j = 0; j < numCols; j++)
+				table->columns[cols[j]].searched = true;
+			return 1;
+		}
+	}
+	for (size_t i = 0; i < numCols; i++)
+		if (table_updatehash(table, &table->columns[cols[i]],
+					cols[i]) < 0)
+			return -1;
+
+	/* only a filter needs the rows that were found apart */
+	found = set;
+	if (rows != NULL) {
+		found = calloc(TABLE_SET_WORDS(table->numRows) + 1,
+				sizeof(*found));
+		if (found == NULL)
+			return -1;
+	}
+	for (size_t i = 0; i < numCols; i++) {
+		const struct table_hash *const hash =
+			table->columns[cols[i]].hash;
+
+		for (size_t j = 0; j < pattern->numAlternatives; j++) {
+			const struct pattern_alternative *const alternative =
+				&pattern->alternatives[j];
+			const struct table_hash_entry *entry;
+			size_t slot;
+
+			if (alternative->kind == PATTERN_NONE)
+				continue;
+			entry = table_findcell(hash, alternative->pieces[0].text,
+					&slot);
+			if (entry == NULL)
+				continue;
+			table_addtoset(found, entry->first);
+			for (size_t k = 0; k < entry->numRows; k++)
+				table_addtoset(found, entry->rows[k]);
+		}
+	}
+	if (rows != NULL) {
+		for (size_t i = 0; i < numRows; i++)
+			if (table_inset(found, rows[i]))
+				table_addtoset(set, rows[i]);
+		free(found);
+	}
+	return 0;
+}
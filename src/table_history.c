@@ -0,0 +1,230 @@
+#include "tabular.h"
+
+static size_t table_partsize(const struct table_diff_part *part)
+{
+	return sizeof(*part->ranges) * part->numRanges +
+		sizeof(*part->words) * part->numWords;
+}
+
+static size_t table_diffsize(const struct table_diff *diff)
+{
+	return table_partsize(&diff->rows) + table_partsize(&diff->cols);
+}
+
+void table_freediff(struct table_diff *diff)
+{
+	free(diff->rows.ranges);
+	free(diff->rows.words);
+	free(diff->cols.ranges);
+	free(diff->cols.words);
+}
+
+static int table_writespill(int fd, const void *data, size_t size, off_t at)
+{
+	const char *p = data;
+	ssize_t count;
+
+	while (size > 0) {
+		count = pwrite(fd, p, size, at);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0)
+			return -1;
+		p += count;
+		size -= count;
+		at += count;
+	}
+	return 0;
+}
+
+static int table_readspill(int fd, void *data, size_t size, off_t at)
+{
+	char *p = data;
+	ssize_t count;
+
+	while (size > 0) {
+		count = pread(fd, p, size, at);
+		if (count < 0 && errno == EINTR)
+			continue;
+		if (count <= 0) {
+			if (count == 0)
+				errno = EIO;
+			return -1;
+		}
+		p += count;
+		size -= count;
+		at += count;
+	}
+	return 0;
+}
+
+/* Writes the parts of the diff to the end of the spill file and frees
+ * them, the counts stay so that they can be read back.
+ */
+static int table_spilldiff(Table *table, struct table_diff *diff)
+{
+	struct table_diff_part *const parts[] = { &diff->rows, &diff->cols };
+	off_t at;
+	int fd;
+
+	if (table->spillFile == NULL) {
+		table->spillFile = tmpfile();
+		if (table->spillFile == NULL)
+			return -1;
+	}
+	fd = fileno(table->spillFile);
+	at = table->spillEnd;
+	for (size_t i = 0; i < ARRLEN(parts); i++) {
+		struct table_diff_part *const part = parts[i];
+		const size_t lenRanges = sizeof(*part->ranges) *
+			part->numRanges;
+		const size_t lenWords = sizeof(*part->words) * part->numWords;
+
+		if (table_writespill(fd, part->ranges, lenRanges, at) < 0 ||
+				table_writespill(fd, part->words, lenWords,
+					at + lenRanges) < 0)
+			return -1;
+		at += lenRanges + lenWords;
+	}
+	table->historyBytes -= table_diffsize(diff);
+	for (size_t i = 0; i < ARRLEN(parts); i++) {
+		free(parts[i]->ranges);
+		free(parts[i]->words);
+		parts[i]->ranges = NULL;
+		parts[i]->words = NULL;
+	}
+	diff->spillAt = table->spillEnd;
+	table->spillEnd = at;
+	return 0;
+}
+
+/* Removes the first numDiffs diffs of the history, if that is behind
+ * indexHistory the diffs that could be redone go as well.
+ */
+static void table_drophistory(Table *table, size_t numDiffs)
+{
+	if (numDiffs > table->indexHistory)
+		numDiffs = table->numHistory;
+	for (size_t i = 0; i < numDiffs; i++) {
+		if (i >= table->numSpilled)
+			table->historyBytes -=
+				table_diffsize(&table->history[i]);
+		table_freediff(&table->history[i]);
+	}
+	memmove(table->history, &table->history[numDiffs],
+			sizeof(*table->history) *
+				(table->numHistory - numDiffs));
+	table->numHistory -= numDiffs;
+	table->indexHistory -= numDiffs;
+	table->numSpilled -= MIN(numDiffs, table->numSpilled);
+	if (table->numSpilled == 0)
+		table->spillEnd = 0;
+}
+
+/* Moves the oldest diffs that are still in memory into the spill file
+ * until the rest fits into historyMem. Diffs that can not be spilled
+ * are dropped, undo then stops before them.
+ */
+static void table_trimhistory(Table *table)
+{
+	while (table->historyBytes > table->historyMem &&
+			table->numSpilled < table->numHistory) {
+		if (table_spilldiff(table,
+					&table->history[table->numSpilled]) < 0) {
+			fprintf(stderr, "error: unable to spill undo "
+					"history: %s\n", strerror(errno));
+			table_drophistory(table, table->numSpilled + 1);
+			continue;
+		}
+		table->numSpilled++;
+	}
+}
+
+int table_appendhistory(Table *table, const struct table_diff *diff)
+{
+	struct table_diff *newHistory;
+
+	if (diff->rows.numRanges == 0 && diff->rows.numWords == 0 &&
+			diff->cols.numRanges == 0 && diff->cols.numWords == 0)
+		return 1;
+
+	/* the diffs that could be redone are replaced by this one */
+	for (size_t i = table->indexHistory; i < table->numHistory; i++) {
+		if (i >= table->numSpilled)
+			table->historyBytes -=
+				table_diffsize(&table->history[i]);
+		table_freediff(&table->history[i]);
+	}
+	if (table->numSpilled > table->indexHistory) {
+		table->spillEnd = table->history[table->indexHistory].spillAt;
+		table->numSpilled = table->indexHistory;
+	}
+	table->numHistory = table->indexHistory;
+	newHistory = realloc(table->history, sizeof(*table->history) *
+			(table->numHistory + 1));
+	if (newHistory == NULL) {
+		table_freediff((struct table_diff*) diff);
+		return -1;
+	}
+	table->history = newHistory;
+	table->history[table->numHistory++] = *diff;
+	table->indexHistory++;
+	table->historyBytes += table_diffsize(diff);
+	table_trimhistory(table);
+	return 0;
+}
+
+int table_loaddiff(Table *table, size_t index, struct table_diff *diff)
+{
+	const struct table_diff *const stored = &table->history[index];
+	struct table_diff_part *const parts[] = { &diff->rows, &diff->cols };
+	off_t at;
+
+	*diff = *stored;
+	if (index >= table->numSpilled)
+		return 0;
+	at = stored->spillAt;
+	for (size_t i = 0; i < ARRLEN(parts); i++) {
+		struct table_diff_part *const part = parts[i];
+		const size_t lenRanges = sizeof(*part->ranges) *
+			part->numRanges;
+		const size_t lenWords = sizeof(*part->words) * part->numWords;
+
+		part->ranges = lenRanges == 0 ? NULL : malloc(lenRanges);
+		part->words = lenWords == 0 ? NULL : malloc(lenWords);
+	}
+	for (size_t i = 0; i < ARRLEN(parts); i++) {
+		struct table_diff_part *const part = parts[i];
+		const size_t lenRanges = sizeof(*part->ranges) *
+			part->numRanges;
+		const size_t lenWords = sizeof(*part->words) * part->numWords;
+
+		if ((lenRanges > 0 && part->ranges == NULL) ||
+				(lenWords > 0 && part->words == NULL) ||
+				table_readspill(fileno(table->spillFile),
+					part->ranges, lenRanges, at) < 0 ||
+				table_readspill(fileno(table->spillFile),
+					part->words, lenWords,
+					at + lenRanges) < 0) {
+			snprintf(table->error, sizeof(table->error),
+					"unable to read undo history: %s",
+					strerror(errno));
+			table->atText = NULL;
+			table_freediff(diff);
+			return -1;
+		}
+		at += lenRanges + lenWords;
+	}
+	return 1;
+}
+
+void table_clearhistory(Table *table)
+{
+	for (size_t i = 0; i < table->numHistory; i++)
+		table_freediff(&table->history[i]);
+	table->indexHistory = 0;
+	table->numHistory = 0;
+	table->historyBytes = 0;
+	table->numSpilled = 0;
+	table->spillEnd = 0;
+}
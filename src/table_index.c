@@ -0,0 +1,442 @@
+#include "tabular.h"
+
+/* A trigram is three bytes of a cell packed into the low bits */
+#define TABLE_TRIGRAMS ((size_t) 1 << 24)
+
+/* The rows of one column that contain each trigram */
+struct table_trigrams {
+	/* the distinct trigrams in ascending order, the rows containing
+	 * keys[i] are rows[starts[i]] up to rows[starts[i + 1]]
+	 */
+	uint32_t *keys;
+	size_t numKeys;
+	size_t *starts;
+	uint32_t *rows;
+};
+
+struct table_index {
+	Table *table;
+	pthread_t thread;
+	/* set by the thread once all columns are indexed */
+	bool ready;
+	/* the rows and columns that were indexed */
+	size_t numRows;
+	size_t numCols;
+	struct table_trigrams *columns;
+	/* rows below numRows whose cells were changed since */
+	uint64_t *changed;
+};
+
+static int table_comparetrigrams(const void *a, const void *b)
+{
+	const uint32_t x = *(const uint32_t*) a, y = *(const uint32_t*) b;
+	return x < y ? -1 : x > y;
+}
+
+static void table_sorttrigrams(uint32_t *trigrams, size_t n)
+{
+	if (n > 16) {
+		qsort(trigrams, n, sizeof(*trigrams), table_comparetrigrams);
+		return;
+	}
+	for (size_t i = 1; i < n; i++) {
+		const uint32_t t = trigrams[i];
+		size_t j;
+
+		for (j = i; j > 0 && trigrams[j - 1] > t; j--)
+			trigrams[j] = trigrams[j - 1];
+		trigrams[j] = t;
+	}
+}
+
+static uint32_t table_trigram(const char *s)
+{
+	return (uint32_t) (unsigned char) s[0] << 16 |
+		(uint32_t) (unsigned char) s[1] << 8 |
+		(unsigned char) s[2];
+}
+
+/* Puts the distinct trigrams of the text into *pTrigrams in ascending
+ * order and returns how many there are, -1 when there is no memory.
+ */
+static ssize_t table_gettrigrams(const char *text, size_t length,
+		uint32_t **pTrigrams, size_t *pCap)
+{
+	uint32_t *trigrams = *pTrigrams;
+	size_t n = 0;
+
+	if (length < 3)
+		return 0;
+	if (length - 2 > *pCap) {
+		trigrams = realloc(trigrams, sizeof(*trigrams) * (length - 2));
+		if (trigrams == NULL)
+			return -1;
+		*pTrigrams = trigrams;
+		*pCap = length - 2;
+	}
+	for (size_t i = 0; i + 2 < length; i++)
+		trigrams[i] = table_trigram(&text[i]);
+	table_sorttrigrams(trigrams, length - 2);
+	for (size_t i = 0; i < length - 2; i++)
+		if (n == 0 || trigrams[n - 1] != trigrams[i])
+			trigrams[n++] = trigrams[i];
+	return n;
+}
+
+static void table_freetrigrams(struct table_trigrams *trigrams)
+{
+	free(trigrams->keys);
+	free(trigrams->starts);
+	free(trigrams->rows);
+}
+
+/* Indexes a column in two passes, the first counts the rows of each
+ * trigram in counts, the second puts the rows in place. counts is all
+ * zero before and after.
+ */
+static int table_indexcolumn(Table *table, size_t col, size_t numRows,
+		uint32_t *counts, uint32_t **pTrigrams, size_t *pCap,
+		struct table_trigrams *index)
+{
+	const size_t numCells = MIN(table->columns[col].numOffsets, numRows);
+	size_t numKeys = 0, total = 0;
+	ssize_t n;
+
+	for (size_t row = 0; row < numCells; row++) {
+		const char *const cell = table_getcell(table, row, col);
+
+		n = table_gettrigrams(cell, strlen(cell), pTrigrams, pCap);
+		if (n < 0)
+			goto err;
+		for (ssize_t i = 0; i < n; i++)
+			if (counts[(*pTrigrams)[i]]++ == 0)
+				numKeys++;
+		total += n;
+	}
+
+	index->keys = malloc(sizeof(*index->keys) * MAX(numKeys, (size_t) 1));
+	index->starts = malloc(sizeof(*index->starts) * (numKeys + 1));
+	index->rows = malloc(sizeof(*index->rows) * MAX(total, (size_t) 1));
+	if (index->keys == NULL || index->starts == NULL ||
+			index->rows == NULL) {
+		table_freetrigrams(index);
+		goto err;
+	}
+	/* from now on counts holds the index of each key plus one */
+	index->numKeys = 0;
+	total = 0;
+	for (size_t t = 0; t < TABLE_TRIGRAMS && index->numKeys < numKeys;
+			t++) {
+		if (counts[t] == 0)
+			continue;
+		index->keys[index->numKeys] = t;
+		index->starts[index->numKeys] = total;
+		total += counts[t];
+		counts[t] = ++index->numKeys;
+	}
+	/* starts[k] moves to the end of key k, which is the start of the
+	 * next one, and is shifted back afterwards
+	 */
+	for (size_t row = 0; row < numCells; row++) {
+		const char *const cell = table_getcell(table, row, col);
+
+		n = table_gettrigrams(cell, strlen(cell), pTrigrams, pCap);
+		for (ssize_t i = 0; i < n; i++)
+			index->rows[index->starts[counts[(*pTrigrams)[i]] -
+				1]++] = row;
+	}
+	memmove(&index->starts[1], index->starts,
+			sizeof(*index->starts) * numKeys);
+	index->starts[0] = 0;
+	for (size_t k = 0; k < numKeys; k++)
+		counts[index->keys[k]] = 0;
+	return 0;
+
+err:
+	memset(counts, 0, sizeof(*counts) * TABLE_TRIGRAMS);
+	return -1;
+}
+
+static void *table_buildindex(void *arg)
+{
+	struct table_index *const index = arg;
+	uint32_t *counts;
+	uint32_t *trigrams = NULL;
+	size_t capTrigrams = 0;
+	size_t numIndexed = 0;
+
+	counts = calloc(TABLE_TRIGRAMS, sizeof(*counts));
+	if (counts == NULL)
+		return NULL;
+	for (; numIndexed < index->numCols; numIndexed++)
+		if (table_indexcolumn(index->table, numIndexed,
+					index->numRows, counts, &trigrams,
+					&capTrigrams,
+					&index->columns[numIndexed]) < 0)
+			break;
+	free(trigrams);
+	free(counts);
+	if (numIndexed < index->numCols) {
+		while (numIndexed > 0)
+			table_freetrigrams(&index->columns[--numIndexed]);
+		return NULL;
+	}
+	__atomic_store_n(&index->ready, true, __ATOMIC_RELEASE);
+	return NULL;
+}
+
+void table_startindex(Table *table)
+{
+	struct table_index *index;
+
+	table_freeindex(table);
+	/* cells of lazy tables can only be read by one thread and the
+	 * rows are stored as 32 bit numbers
+	 */
+	if (table->lazy != NULL || table->numRows == 0 ||
+			table->numRows > UINT32_MAX)
+		return;
+	index = calloc(1, sizeof(*index));
+	if (index == NULL)
+		return;
+	index->table = table;
+	index->numRows = table->numRows;
+	index->numCols = table->numCols;
+	index->columns = calloc(table->numCols, sizeof(*index->columns));
+	index->changed = calloc(TABLE_SET_WORDS(table->numRows),
+			sizeof(*index->changed));
+	if (index->columns == NULL || index->changed == NULL ||
+			pthread_create(&index->thread, NULL, table_buildindex,
+				index) != 0) {
+		free(index->columns);
+		free(index->changed);
+		free(index);
+		return;
+	}
+	table->index = index;
+}
+
+void table_waitindex(Table *table)
+{
+	struct table_index *const index = table->index;
+
+	if (index == NULL || index->table == NULL)
+		return;
+	pthread_join(index->thread, NULL);
+	/* the thread is done, it is only joined once */
+	index->table = NULL;
+	if (!index->ready)
+		table_freeindex(table);
+}
+
+void table_freeindex(Table *table)
+{
+	struct table_index *const index = table->index;
+
+	if (index == NULL)
+		return;
+	if (index->table != NULL)
+		pthread_join(index->thread, NULL);
+	if (index->ready)
+		for (size_t i = 0; i < index->numCols; i++)
+			table_freetrigrams(&index->columns[i]);
+	free(index->columns);
+	free(index->changed);
+	free(index);
+	table->index = NULL;
+}
+
+void table_touchindex(Table *table, size_t row)
+{
+	struct table_index *const index = table->index;
+
+	if (index != NULL && row < index->numRows)
+		table_addtoset(index->changed, row);
+}
+
+static const uint32_t *table_findtrigram(const struct table_trigrams *index,
+		uint32_t key, size_t *pNum)
+{
+	size_t lo = 0, hi = index->numKeys;
+
+	while (lo < hi) {
+		const size_t mid = lo + (hi - lo) / 2;
+
+		if (index->keys[mid] < key)
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+	if (lo == index->numKeys || index->keys[lo] != key) {
+		*pNum = 0;
+		return NULL;
+	}
+	*pNum = index->starts[lo + 1] - index->starts[lo];
+	return &index->rows[index->starts[lo]];
+}
+
+/* Removes the rows that are not in list from rows, both ascending.
+ * Returns how many are left.
+ */
+static size_t table_intersectrows(uint32_t *rows, size_t numRows,
+		const uint32_t *list, size_t numList)
+{
+	size_t n = 0, lo = 0;
+
+	for (size_t i = 0; i < numRows && lo < numList; i++) {
+		size_t hi = numList;
+
+		/* the rows are ascending, so the search starts where the
+		 * last one ended
+		 */
+		while (lo < hi) {
+			const size_t mid = lo + (hi - lo) / 2;
+
+			if (list[mid] < rows[i])
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+		if (lo < numList && list[lo] == rows[i])
+			rows[n++] = rows[i];
+	}
+	return n;
+}
+
+/* Adds the rows of the column that contain every trigram of the pieces
+ * of the alternative to the set. Returns 1 when the alternative has no
+ * trigram, so that any row might match it.
+ */
+static int table_addcandidates(const struct table_trigrams *index,
+		const struct pattern_alternative *alternative, uint64_t *set)
+{
+	const uint32_t *shortest = NULL;
+	size_t numShortest = 0;
+	bool hasTrigram = false;
+	uint32_t *rows;
+	size_t numRows;
+
+	/* the rarest trigram gives the fewest rows to start from */
+	for (size_t i = 0; i < alternative->numPieces; i++) {
+		const struct pattern_piece *const piece =
+			&alternative->pieces[i];
+
+		for (size_t j = 0; j + 2 < piece->length; j++) {
+			const uint32_t *list;
+			size_t num;
+
+			list = table_findtrigram(index,
+					table_trigram(&piece->text[j]), &num);
+			if (!hasTrigram || num < numShortest) {
+				shortest = list;
+				numShortest = num;
+			}
+			hasTrigram = true;
+		}
+	}
+	if (!hasTrigram)
+		return 1;
+	if (numShortest == 0)
+		return 0;
+	rows = malloc(sizeof(*rows) * numShortest);
+	if (rows == NULL)
+		return -1;
+	memcpy(rows, shortest, sizeof(*rows) * numShortest);
+	numRows = numShortest;
+	for (size_t i = 0; i < alternative->numPieces && numRows > 0; i++) {
+		const struct pattern_piece *const piece =
+			&alternative->pieces[i];
+
+		for (size_t j = 0; j + 2 < piece->length && numRows > 0; j++) {
+			const uint32_t *list;
+			size_t num;
+
+			list = table_findtrigram(index,
+					table_trigram(&piece->text[j]), &num);
+			if (list != shortest)
+				numRows = table_intersectrows(rows, numRows,
+						list, num);
+		}
+	}
+	for (size_t i = 0; i < numRows; i++)
+		table_addtoset(set, rows[i]);
+	free(rows);
+	return 0;
+}
+
+int table_indexcandidates(Table *table, const Pattern *pattern,
+		const size_t *cols, size_t numCols,
+		const size_t *rows, size_t numRows,
+		size_t **pCandidates, size_t *pNumCandidates)
+{
+	struct table_index *const index = table->index;
+	uint64_t *set;
+	size_t *candidates;
+	size_t numCandidates = 0;
+	int code = 1;
+
+	if (index == NULL || table->lazy != NULL ||
+			!__atomic_load_n(&index->ready, __ATOMIC_ACQUIRE))
+		return 1;
+	for (size_t i = 0; i < numCols; i++)
+		if (cols[i] >= index->numCols)
+			return 1;
+	set = calloc(TABLE_SET_WORDS(table->numRows) + 1, sizeof(*set));
+	if (set == NULL)
+		return -1;
+	for (size_t i = 0; i < numCols; i++) {
+		const struct table_trigrams *const trigrams =
+			&index->columns[cols[i]];
+
+		for (size_t j = 0; j < pattern->numAlternatives; j++) {
+			const struct pattern_alternative *const alternative =
+				&pattern->alternatives[j];
+
+			if (alternative->kind == PATTERN_NONE)
+				continue;
+			code = alternative->kind == PATTERN_ANY ? 1 :
+				table_addcandidates(trigrams, alternative, set);
+			if (code != 0)
+				goto end;
+		}
+	}
+	/* the index does not know what changed since it was built */
+	for (size_t i = 0; i < TABLE_SET_WORDS(MIN(index->numRows,
+					table->numRows)); i++)
+		set[i] |= index->changed[i];
+	for (size_t row = index->numRows; row < table->numRows; row++)
+		table_addtoset(set, row);
+
+	if (rows == NULL) {
+		for (size_t i = 0; i < TABLE_SET_WORDS(table->numRows); i++)
+			numCandidates += __builtin_popcountll(set[i]);
+	} else {
+		for (size_t i = 0; i < numRows; i++)
+			numCandidates += table_inset(set, rows[i]);
+	}
+	candidates = malloc(sizeof(*candidates) * MAX(numCandidates,
+				(size_t) 1));
+	if (candidates == NULL) {
+		code = -1;
+		goto end;
+	}
+	numCandidates = 0;
+	if (rows == NULL) {
+		for (size_t i = 0; i < TABLE_SET_WORDS(table->numRows); i++)
+			for (uint64_t bits = set[i]; bits != 0;
+					bits &= bits - 1)
+				candidates[numCandidates++] = i * 64 +
+					__builtin_ctzll(bits);
+	} else {
+		for (size_t i = 0; i < numRows; i++)
+			if (table_inset(set, rows[i]))
+				candidates[numCandidates++] = rows[i];
+	}
+	*pCandidates = candidates;
+	*pNumCandidates = numCandidates;
+	code = 0;
+
+end:
+	free(set);
+	return code;
+}
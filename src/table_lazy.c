@@ -0,0 +1,365 @@
+#include "tabular.h"
+
+/* Number of parsed rows that are kept, must be a power of two */
+#define TABLE_LAZY_ROWS ((size_t) 4096)
+
+struct table_lazy {
+	/* the mapping the lines are in, end has a spare null byte */
+	char *text;
+	char *end;
+	/* start of each row in text */
+	size_t *lines;
+	/* The index in the file of the line of row 0. Blank lines are not
+	 * rows, the rows from row on are numSkipped lines further down,
+	 * the gaps are in ascending order.
+	 */
+	size_t firstLine;
+	struct table_lazy_gap {
+		size_t row;
+		size_t numSkipped;
+	} *gaps;
+	size_t numGaps;
+	/* the parsed rows, most recently used first */
+	struct table_lazy_row {
+		/* SIZE_MAX when the slot is not used */
+		size_t row;
+		/* copy of the line that the cells point into */
+		char *line;
+		size_t capLine;
+		Utf8 **cells;
+		struct table_lazy_row *nextInBucket;
+		struct table_lazy_row *prev, *next;
+	} rows[TABLE_LAZY_ROWS];
+	struct table_lazy_row *buckets[TABLE_LAZY_ROWS];
+	struct table_lazy_row *first, *last;
+	/* the rows before are known to parse, see table_checklazy() */
+	size_t numChecked;
+	/* copy of the line that is checked */
+	char *check;
+	size_t capCheck;
+};
+
+static Utf8 table_lazyemptycell[1];
+
+static int table_addlazygap(struct table_lazy *lazy, size_t row,
+		size_t numSkipped)
+{
+	struct table_lazy_gap *newGaps;
+
+	newGaps = realloc(lazy->gaps, sizeof(*lazy->gaps) *
+			(lazy->numGaps + 1));
+	if (newGaps == NULL)
+		return -1;
+	lazy->gaps = newGaps;
+	lazy->gaps[lazy->numGaps].row = row;
+	lazy->gaps[lazy->numGaps].numSkipped = numSkipped;
+	lazy->numGaps++;
+	return 0;
+}
+
+int table_setlazy(Table *table, char *begin, char *end, size_t firstLine)
+{
+	struct table_lazy *lazy;
+	size_t *lines = NULL;
+	size_t numLines = 0, capLines = 0;
+	size_t numSkipped = 0;
+	bool skipped = false;
+	char *line, *next, *newline;
+
+	lazy = calloc(1, sizeof(*lazy));
+	if (lazy == NULL)
+		goto err;
+	for (line = begin; line != end; line = next) {
+		newline = memchr(line, '\n', end - line);
+		next = newline == NULL ? end : newline + 1;
+		if (newline == line) {
+			numSkipped++;
+			skipped = true;
+			continue;
+		}
+		if (skipped) {
+			if (table_addlazygap(lazy, numLines, numSkipped) < 0)
+				goto err;
+			skipped = false;
+		}
+		if (numLines == capLines) {
+			size_t *newLines;
+
+			capLines = capLines * 2 + 1024;
+			newLines = realloc(lines, sizeof(*lines) * capLines);
+			if (newLines == NULL)
+				goto err;
+			lines = newLines;
+		}
+		if (table->quote == TABLE_QUOTE_KEEP &&
+				table_keepable(line, (newline == NULL ?
+						end : newline) - line) &&
+				table_keepline(table, table->numRows + numLines,
+					line - table->mappedText,
+					(newline == NULL ? end : newline) -
+						line) < 0) {
+			free(lines);
+			free(lazy->gaps);
+			free(lazy);
+			return -1;
+		}
+		lines[numLines++] = line - table->mappedText;
+	}
+	if (table_reserverows(table, numLines) < 0) {
+		free(lines);
+		free(lazy->gaps);
+		free(lazy);
+		return -1;
+	}
+	for (size_t i = 0; i < TABLE_LAZY_ROWS; i++) {
+		struct table_lazy_row *const row = &lazy->rows[i];
+
+		row->row = SIZE_MAX;
+		row->cells = calloc(table->numCols, sizeof(*row->cells));
+		if (row->cells == NULL) {
+			while (i > 0)
+				free(lazy->rows[--i].cells);
+			goto err;
+		}
+		row->prev = i == 0 ? NULL : &lazy->rows[i - 1];
+		row->next = i + 1 == TABLE_LAZY_ROWS ? NULL :
+			&lazy->rows[i + 1];
+	}
+	lazy->first = &lazy->rows[0];
+	lazy->last = &lazy->rows[TABLE_LAZY_ROWS - 1];
+	lazy->text = table->mappedText;
+	lazy->end = end;
+	lazy->lines = lines;
+	lazy->firstLine = firstLine;
+	table->lazy = lazy;
+	table->numRows = numLines;
+	return 0;
+
+err:
+	snprintf(table->error, sizeof(table->error), "%s", strerror(errno));
+	table->atText = NULL;
+	free(lines);
+	if (lazy != NULL)
+		free(lazy->gaps);
+	free(lazy);
+	return -1;
+}
+
+/* Copies the line of the row into *pLine, which is grown as needed.
+ * Returns its length or -1 when there is no memory.
+ */
+static ssize_t table_copylazyline(const struct table_lazy *lazy, size_t row,
+		char **pLine, size_t *pCapLine)
+{
+	const char *const line = &lazy->text[lazy->lines[row]];
+	const char *newline;
+	size_t length;
+
+	newline = memchr(line, '\n', lazy->end - line);
+	length = (newline == NULL ? lazy->end : newline) - line;
+	if (*pCapLine < length + 1) {
+		char *newLine;
+
+		newLine = realloc(*pLine, length + 1);
+		if (newLine == NULL)
+			return -1;
+		*pLine = newLine;
+		*pCapLine = length + 1;
+	}
+	memcpy(*pLine, line, length);
+	(*pLine)[length] = '\0';
+	return length;
+}
+
+/* Copies the line of the row into the slot and splits it there, a line
+ * that can not be parsed has only empty cells. table_checklazy() finds
+ * those lines before the whole table is used.
+ */
+static void table_parselazyrow(Table *table, struct table_lazy_row *slot,
+		size_t row)
+{
+	ssize_t length;
+
+	length = table_copylazyline(table->lazy, row, &slot->line,
+			&slot->capLine);
+	if (length >= 0 && table_splitline(table, slot->line, length,
+				slot->cells) == 0)
+		return;
+	for (size_t i = 0; i < table->numCols; i++)
+		slot->cells[i] = table_lazyemptycell;
+}
+
+/* The index of the line of the row in its file, blank lines count. */
+static size_t table_lazylineindex(const struct table_lazy *lazy, size_t row)
+{
+	size_t low = 0, high = lazy->numGaps;
+
+	/* the last gap at or before the row */
+	while (low < high) {
+		const size_t mid = (low + high) / 2;
+
+		if (lazy->gaps[mid].row <= row)
+			low = mid + 1;
+		else
+			high = mid;
+	}
+	return lazy->firstLine + row +
+		(low == 0 ? 0 : lazy->gaps[low - 1].numSkipped);
+}
+
+const Utf8 *table_getlazycell(Table *table, size_t row, size_t col)
+{
+	struct table_lazy *const lazy = table->lazy;
+	struct table_lazy_row **const bucket =
+		&lazy->buckets[row & (TABLE_LAZY_ROWS - 1)];
+	struct table_lazy_row *slot;
+
+	for (slot = *bucket; slot != NULL; slot = slot->nextInBucket)
+		if (slot->row == row)
+			break;
+	if (slot == NULL) {
+		/* reuse the least recently used slot */
+		slot = lazy->last;
+		if (slot->row != SIZE_MAX) {
+			struct table_lazy_row **p;
+
+			p = &lazy->buckets[slot->row & (TABLE_LAZY_ROWS - 1)];
+			while (*p != slot)
+				p = &(*p)->nextInBucket;
+			*p = slot->nextInBucket;
+		}
+		table_parselazyrow(table, slot, row);
+		slot->row = row;
+		slot->nextInBucket = *bucket;
+		*bucket = slot;
+	}
+	if (slot != lazy->first) {
+		slot->prev->next = slot->next;
+		if (slot->next == NULL)
+			lazy->last = slot->prev;
+		else
+			slot->next->prev = slot->prev;
+		slot->prev = NULL;
+		slot->next = lazy->first;
+		lazy->first->prev = slot;
+		lazy->first = slot;
+	}
+	return slot->cells[col];
+}
+
+static void table_freelazy(struct table_lazy *lazy)
+{
+	for (size_t i = 0; i < TABLE_LAZY_ROWS; i++) {
+		free(lazy->rows[i].line);
+		free(lazy->rows[i].cells);
+	}
+	free(lazy->lines);
+	free(lazy->gaps);
+	free(lazy->check);
+	free(lazy);
+}
+
+/* Drops everything that refers to rows behind table->numRows. */
+static void table_droplazyrows(Table *table)
+{
+	const size_t first = table->numRows / 64;
+	const uint64_t kept = ((uint64_t) 1 << (table->numRows % 64)) - 1;
+
+	for (size_t i = first; i < TABLE_SET_WORDS(table->capRows); i++) {
+		table->rowSet[i] &= i == first ? kept : 0;
+		table->newRowSet[i] &= i == first ? kept : 0;
+	}
+	table_listactive(table);
+	table->numLines = MIN(table->numLines, table->numRows);
+	table_clearhistory(table);
+}
+
+int table_checklazy(Table *table, size_t *pLineIndex, const char **pLine)
+{
+	struct table_lazy *const lazy = table->lazy;
+	Utf8 **cells;
+	ssize_t length;
+
+	*pLine = NULL;
+	if (lazy == NULL || lazy->numChecked == table->numRows)
+		return 0;
+	cells = malloc(sizeof(*cells) * MAX(table->numCols, (size_t) 1));
+	if (cells == NULL)
+		goto err;
+	for (; lazy->numChecked < table->numRows; lazy->numChecked++) {
+		const size_t row = lazy->numChecked;
+
+		length = table_copylazyline(lazy, row, &lazy->check,
+				&lazy->capCheck);
+		if (length < 0)
+			goto err;
+		if (table_splitline(table, lazy->check, length, cells) == 0)
+			continue;
+		/* splitting put null bytes into the copy, the error still
+		 * points into it
+		 */
+		table_copylazyline(lazy, row, &lazy->check, &lazy->capCheck);
+		*pLineIndex = table_lazylineindex(lazy, row);
+		*pLine = lazy->check;
+		table->numRows = row;
+		table_droplazyrows(table);
+		free(cells);
+		return -1;
+	}
+	free(cells);
+	return 0;
+
+err:
+	snprintf(table->error, sizeof(table->error), "%s", strerror(errno));
+	table->atText = NULL;
+	free(cells);
+	return -1;
+}
+
+int table_materialize(Table *table)
+{
+	struct table_lazy *const lazy = table->lazy;
+	char *const mappedText = table->mappedText;
+	const size_t numRows = table->numRows;
+	int code = 0;
+
+	if (lazy == NULL)
+		return 0;
+	table->lazy = NULL;
+	table->numRows = 0;
+	/* the rows borrow from the lazy mapping even if others were
+	 * added since
+	 */
+	table->mappedText = lazy->text;
+	for (size_t i = 0; i < numRows; i++) {
+		char *const line = &lazy->text[lazy->lines[i]];
+		char *newline;
+
+		newline = memchr(line, '\n', lazy->end - line);
+		if (newline == NULL)
+			newline = lazy->end;
+		*newline = '\0';
+		if (table_parsemappedline(table, line, newline - line) < 0) {
+			char error[sizeof(table->error)];
+
+			memcpy(error, table->error, sizeof(error));
+			snprintf(table->error, sizeof(table->error),
+					"%.90s at line no. %zu", error,
+					table_lazylineindex(lazy, i) + 1);
+			table->atText = NULL;
+			table_droplazyrows(table);
+			code = -1;
+			break;
+		}
+	}
+	table->mappedText = mappedText;
+	table_freelazy(lazy);
+	return code;
+}
+
+void table_uninitlazy(Table *table)
+{
+	if (table->lazy != NULL)
+		table_freelazy(table->lazy);
+	table->lazy = NULL;
+}
@@ -15,174 +15,177 @@ static void table_filterrows(Table *table, const Utf8 *filter);
 static void table_filtercols(Table *table, const Utf8 *filter);
 static void table_selectrows(Table *table, const Utf8 *filter);
 static void table_selectcols(Table *table, const Utf8 *filter);
-
-static int table_appendcol(Table *table, const char *name);
+static void table_whererows(Table *table, enum table_operation operation,
+		const Utf8 *predicate);
 
 static void table_redo(Table *table);
 static void table_undo(Table *table);
 
-void table_validatediff(Table *table, struct table_diff *diff)
+static int table_setjobs(Table *table, const char *arg);
+static int table_setquote(Table *table, const char *arg);
+static int table_sethistorymem(Table *table, const char *arg);
+
+/* Lists the members of the set in ascending order, returns how many
+ * there are.
+ */
+static size_t table_listset(const uint64_t *set, size_t numBits,
+		size_t *list)
 {
-	for (size_t i = 0; i < diff->numChangedCols; i++)
-		diff->colDiff[i].col =
-			table->activeCols[diff->colDiff[i].index];
-	for (size_t i = 0; i < diff->numChangedRows; i++)
-		diff->rowDiff[i].row =
-			table->activeRows[diff->rowDiff[i].index];
+	size_t n = 0;
+
+	for (size_t i = 0; i < TABLE_SET_WORDS(numBits); i++)
+		for (uint64_t bits = set[i]; bits != 0; bits &= bits - 1)
+			list[n++] = i * 64 + __builtin_ctzll(bits);
+	return n;
 }
 
-struct table_diff_part {
-	size_t index;
-	size_t value;
-};
+static void table_clearset(uint64_t *set, size_t numBits)
+{
+	for (size_t i = 0; i < TABLE_SET_WORDS(numBits); i++)
+		set[i] = 0;
+}
 
-static struct table_diff_part *
-getdiff(size_t *a, size_t na, size_t *b, size_t nb,
-		struct table_diff_part **pc, size_t *pnc)
-{
-	struct table_diff_part *c, *sc;
-	size_t nc = 0;
-	bool inBoth;
-
-	c = malloc(sizeof(*c) * (na + nb));
-	if (c == NULL)
-		goto no_diff;
-	for (size_t i = 0; i < na; i++) {
-		inBoth = false;
-		for (size_t j = 0; i < nb; j++)
-			if (a[i] == b[j]) {
-				inBoth = true;
-				break;
-			}
-		if (!inBoth) {
-			c[nc].index = i;
-			c[nc].value = a[i];
-			nc++;
-		}
-	}
+static void table_copyset(uint64_t *set, const uint64_t *from,
+		size_t numBits)
+{
+	for (size_t i = 0; i < TABLE_SET_WORDS(numBits); i++)
+		set[i] = from[i];
+}
 
-	for (size_t i = 0; i < nb; i++) {
-		inBoth = false;
-		for (size_t j = 0; i < na; j++)
-			if (b[i] == a[j]) {
-				inBoth = true;
-				break;
-			}
-		if (!inBoth) {
-			c[nc].index = i;
-			c[nc].value = b[i];
-			nc++;
-		}
-	}
-	if (nc == 0 || (sc = realloc(c, sizeof(*c) * nc))) {
-		free(c);
-		goto no_diff;
-	}
-	*pc = sc;
-	*pnc = nc;
-	return sc;
+/* Sets the first numBits bits of set to the complement of those of from,
+ * from is NULL for the empty set.
+ */
+static void table_invertset(uint64_t *set, const uint64_t *from,
+		size_t numBits)
+{
+	for (size_t i = 0; i < numBits / 64; i++)
+		set[i] = from == NULL ? UINT64_MAX : ~from[i];
+	if (numBits % 64 != 0)
+		set[numBits / 64] = (from == NULL ? UINT64_MAX :
+				~from[numBits / 64]) &
+			(((uint64_t) 1 << (numBits % 64)) - 1);
+}
 
-no_diff:
-	*pc = NULL;
-	*pnc = 0;
-	return NULL;
+void table_listactive(Table *table)
+{
+	table->numActiveRows = table_listset(table->rowSet, table->numRows,
+			table->activeRows);
+	table->numActiveCols = table_listset(table->colSet, table->numCols,
+			table->activeCols);
 }
 
-void table_applydiff(Table *table, const struct table_diff *diff)
+/* Makes set equal to newSet and puts what changed into the part of a
+ * diff. The changes are kept as the runs of changed bits unless the
+ * changed words themselves are smaller, so that selecting everything
+ * is a single range while a scattered change costs at most one bit per
+ * row. The part is empty if nothing changed or there is no memory.
+ */
+static void table_diffset(uint64_t *set, const uint64_t *newSet,
+		size_t numBits, struct table_diff_part *part)
 {
-	bool found;
-
-	for (size_t i = 0; i < diff->numChangedRows; i++) {
-		found = false;
-		for (size_t j = 0; j < table->numActiveRows; j++)
-			if (diff->rowDiff[i].row == table->activeRows[j]) {
-				table->numActiveRows--;
-				memmove(&table->activeRows[j],
-					&table->activeRows[j + 1],
-					sizeof(*table->activeRows) *
-						(table->numActiveRows - j));
-				found = true;
-				break;
-			}
-		if (!found) {
-			const size_t index = diff->rowDiff[i].index;
-			memmove(&table->activeRows[index + 1],
-				&table->activeRows[index],
-				sizeof(*table->activeRows) *
-					(table->numActiveRows - index));
-			table->activeRows[index] = diff->rowDiff[i].row;
-			table->numActiveRows++;
+	const size_t numWords = TABLE_SET_WORDS(numBits);
+	size_t numRuns = 0, firstWord = numWords, lastWord = 0;
+	uint64_t prev = 0;
+
+	memset(part, 0, sizeof(*part));
+	for (size_t i = 0; i < numWords; i++) {
+		const uint64_t changed = set[i] ^ newSet[i];
+
+		/* bits that start a run */
+		numRuns += __builtin_popcountll(changed &
+				~(changed << 1 | prev >> 63));
+		if (changed != 0) {
+			firstWord = MIN(firstWord, i);
+			lastWord = i;
 		}
+		prev = changed;
 	}
+	if (numRuns == 0)
+		return;
 
-	for (size_t i = 0; i < diff->numChangedCols; i++) {
-		found = false;
-		for (size_t j = 0; j < table->numActiveCols; j++)
-			if (diff->colDiff[i].col == table->activeCols[j]) {
-				table->numActiveCols--;
-				memmove(&table->activeCols[j],
-					&table->activeCols[j + 1],
-					sizeof(*table->activeCols) *
-						(table->numActiveCols - j));
-				found = true;
-				break;
-			}
-		if (!found) {
-			const size_t index = diff->colDiff[i].index;
-			memmove(&table->activeCols[index + 1],
-				&table->activeCols[index],
-				sizeof(*table->activeCols) *
-					(table->numActiveCols - index));
-			table->activeCols[index] = diff->colDiff[i].col;
-			table->numActiveCols++;
+	if (sizeof(*part->ranges) * numRuns <=
+			sizeof(*part->words) * (lastWord - firstWord + 1)) {
+		size_t n = 0;
+
+		part->ranges = malloc(sizeof(*part->ranges) * numRuns);
+		prev = 0;
+		for (size_t i = firstWord; part->ranges != NULL &&
+				i <= lastWord; i++) {
+			const uint64_t changed = set[i] ^ newSet[i];
+			const uint64_t next = i == lastWord ? 0 :
+				set[i + 1] ^ newSet[i + 1];
+			uint64_t starts = changed &
+				~(changed << 1 | prev >> 63);
+			uint64_t ends = changed & ~(changed >> 1 | next << 63);
+
+			prev = changed;
+			/* a run that started in an earlier word ends
+			 * before the next one starts
+			 */
+			while ((starts | ends) != 0)
+				if (starts != 0 && (ends == 0 ||
+						__builtin_ctzll(starts) <=
+						__builtin_ctzll(ends))) {
+					part->ranges[n].first = i * 64 +
+						__builtin_ctzll(starts);
+					starts &= starts - 1;
+				} else {
+					part->ranges[n].count = i * 64 +
+						__builtin_ctzll(ends) + 1 -
+						part->ranges[n].first;
+					n++;
+					ends &= ends - 1;
+				}
+		}
+		part->numRanges = part->ranges == NULL ? 0 : numRuns;
+	} else {
+		part->words = malloc(sizeof(*part->words) *
+				(lastWord - firstWord + 1));
+		if (part->words != NULL) {
+			for (size_t i = firstWord; i <= lastWord; i++)
+				part->words[i - firstWord] =
+					set[i] ^ newSet[i];
+			part->firstWord = firstWord;
+			part->numWords = lastWord - firstWord + 1;
 		}
 	}
+	table_copyset(set, newSet, numBits);
 }
 
-int table_appendhistory(Table *table, const struct table_diff *diff)
+static void table_applypart(uint64_t *set, const struct table_diff_part *part)
 {
-	struct table_diff *newHistory;
+	for (size_t i = 0; i < part->numRanges; i++) {
+		size_t bit = part->ranges[i].first;
+		const size_t end = bit + part->ranges[i].count;
 
-	if (diff->numChangedRows == 0 && diff->numChangedCols == 0)
-		return 1;
+		while (bit < end) {
+			const size_t n = MIN(64 - bit % 64, end - bit);
 
-	for (size_t i = table->indexHistory; i < table->numHistory; i++) {
-		free(table->history[i].rowDiff);
-		free(table->history[i].colDiff);
-	}
-	table->numHistory = table->indexHistory;
-	newHistory = realloc(table->history, sizeof(*table->history) *
-			(table->numHistory + 1));
-	if (newHistory == NULL) {
-		free(diff->rowDiff);
-		free(diff->colDiff);
-		return -1;
+			set[bit / 64] ^= (n == 64 ? UINT64_MAX :
+					((uint64_t) 1 << n) - 1) << (bit % 64);
+			bit += n;
+		}
 	}
-	table->history = newHistory;
-	table->history[table->numHistory++] = *diff;
-	table->indexHistory++;
-	return 0;
+	for (size_t i = 0; i < part->numWords; i++)
+		set[part->firstWord + i] ^= part->words[i];
+}
+
+void table_applydiff(Table *table, const struct table_diff *diff)
+{
+	table_applypart(table->rowSet, &diff->rows);
+	table_applypart(table->colSet, &diff->cols);
+	table_listactive(table);
 }
 
 int table_generatediff(Table *table)
 {
 	struct table_diff diff;
 
-	getdiff(table->newActiveRows, table->newNumActiveRows,
-			table->activeRows, table->numActiveRows,
-			(struct table_diff_part**) &diff.rowDiff,
-			&diff.numChangedRows);
-	getdiff(table->newActiveCols, table->newNumActiveCols,
-			table->activeCols, table->numActiveCols,
-			(struct table_diff_part**) &diff.colDiff,
-			&diff.numChangedCols);
-
-	memcpy(table->activeRows, table->newActiveRows,
-		sizeof(*table->newActiveRows) * table->newNumActiveRows);
-	table->numActiveRows = table->newNumActiveRows;
-	memcpy(table->activeCols, table->newActiveCols,
-		sizeof(*table->newActiveCols) * table->newNumActiveCols);
-	table->numActiveCols = table->newNumActiveCols;
+	table_diffset(table->rowSet, table->newRowSet, table->numRows,
+			&diff.rows);
+	table_diffset(table->colSet, table->newColSet, table->numCols,
+			&diff.cols);
+	table_listactive(table);
 
 	if (table_appendhistory(table, &diff) < 0)
 		return -1;
@@ -206,6 +209,8 @@ void table_dooperation(Table *table, enum table_operation operation, const void
 		break;
 	case TABLE_OPERATION_INPUT:
 		table_readin(table, arg);
+		if (table->useIndex)
+			table_startindex(table);
 		break;
 
 	case TABLE_OPERATION_ALL:
@@ -235,29 +240,26 @@ void table_dooperation(Table *table, enum table_operation operation, const void
 		table_generatediff(table);
 		break;
 	case TABLE_OPERATION_NONE:
-		table->newNumActiveRows = 0;
-		table->newNumActiveCols = 0;
+		table_clearset(table->newRowSet, table->numRows);
+		table_clearset(table->newColSet, table->numCols);
 		table_generatediff(table);
 		break;
 	case TABLE_OPERATION_NO_ROWS:
-		table->newNumActiveRows = 0;
-		table->newNumActiveCols = table->numActiveCols;
-		memcpy(table->newActiveCols, table->activeCols,
-				sizeof(*table->activeCols) *
-					table->numActiveCols);
+		table_clearset(table->newRowSet, table->numRows);
+		table_copyset(table->newColSet, table->colSet, table->numCols);
 		table_generatediff(table);
 		break;
 	case TABLE_OPERATION_NO_COLS:
-		table->newNumActiveRows = table->numActiveRows;
-		memcpy(table->newActiveRows, table->activeRows,
-				sizeof(*table->activeRows) *
-					table->numActiveRows);
-		table->numActiveCols = 0;
+		table_copyset(table->newRowSet, table->rowSet, table->numRows);
+		table_clearset(table->newColSet, table->numCols);
 		table_generatediff(table);
 		break;
 
 	case TABLE_OPERATION_ROW:
-		table_filterrows(table, arg);
+		if (!table_recallrows(table, true, arg)) {
+			table_filterrows(table, arg);
+			table_keeprows(table, true, arg);
+		}
 		table_generatediff(table);
 		break;
 	case TABLE_OPERATION_COL:
@@ -265,19 +267,30 @@ void table_dooperation(Table *table, enum table_operation operation, const void
 		table_generatediff(table);
 		break;
 	case TABLE_OPERATION_SET_ROW:
-		table_selectrows(table, arg);
+		if (!table_recallrows(table, false, arg)) {
+			table_selectrows(table, arg);
+			table_keeprows(table, false, arg);
+		}
 		table_generatediff(table);
 		break;
 	case TABLE_OPERATION_SET_COL:
 		table_selectcols(table, arg);
 		table_generatediff(table);
 		break;
+	case TABLE_OPERATION_WHERE:
+	case TABLE_OPERATION_AND_WHERE:
+	case TABLE_OPERATION_OR_WHERE:
+		table_whererows(table, operation, arg);
+		table_generatediff(table);
+		break;
 
 	case TABLE_OPERATION_APPEND:
-		table_parseline(table, arg == NULL ? "" : arg);
+		if (table_parseline(table, arg == NULL ? "" : arg) < 0)
+			fprintf(stderr, "error: %s\n", table_strerror(table));
 		break;
 	case TABLE_OPERATION_APPEND_COL:
-		table_appendcol(table, arg == NULL ? "" : arg);
+		if (table_appendcol(table, arg == NULL ? "" : arg) < 0)
+			fprintf(stderr, "error: %s\n", table_strerror(table));
 		break;
 
 	case TABLE_OPERATION_UNDO:
@@ -286,16 +299,67 @@ void table_dooperation(Table *table, enum table_operation operation, const void
 	case TABLE_OPERATION_REDO:
 		table_redo(table);
 		break;
+
+	case TABLE_OPERATION_JOBS:
+		table_setjobs(table, arg);
+		break;
+	case TABLE_OPERATION_CACHE:
+		table->useCache = true;
+		break;
+	case TABLE_OPERATION_LAZY:
+		table->useLazy = true;
+		break;
+	case TABLE_OPERATION_QUOTE:
+		table_setquote(table, arg);
+		break;
+	case TABLE_OPERATION_HISTORY_MEM:
+		table_sethistorymem(table, arg);
+		break;
+	case TABLE_OPERATION_INDEX:
+		/* a table that is already loaded is indexed right away */
+		if (!table->useIndex && table->numRows > 0)
+			table_startindex(table);
+		table->useIndex = true;
+		break;
 	}
 }
 
+static void table_printparseerror(Table *table, size_t lineIndex,
+		const char *line)
+{
+	fprintf(stderr, "error: %s at line no. %zu\n%s\n",
+			table_strerror(table), lineIndex + 1, line);
+	if (table->atText != NULL) {
+		for (const char *s = line; s != table->atText; s++)
+			fprintf(stderr, "~");
+		fprintf(stderr, "^\n");
+	}
+}
+
+/* The rows of a lazy table are all parsed once before they are used
+ * as a whole, a bad line is reported as when loading it eagerly.
+ */
+static void table_checkrows(Table *table)
+{
+	size_t lineIndex;
+	const char *line;
+
+	if (table_checklazy(table, &lineIndex, &line) == 0)
+		return;
+	if (line == NULL)
+		fprintf(stderr, "error: %s\n", table_strerror(table));
+	else
+		table_printparseerror(table, lineIndex, line);
+}
+
 static void table_printactivecells(Table *table)
 {
+	table_checkrows(table);
 	if (table->numActiveCols == 1) {
 		for (size_t i = 0; i < table->numActiveRows; i++) {
 			const size_t row = table->activeRows[i];
 			const size_t col = table->activeCols[0];
-			printf("%s\n", table->cells[row][col]);
+			printf("%s\n", table_getcell(table, row, col));
 		}
 		return;
 	}
@@ -304,17 +368,22 @@ static void table_printactivecells(Table *table)
 		printf("%s\n", table->colNames[col]);
 		for (size_t j = 0; j < table->numActiveRows; j++) {
 			const size_t row = table->activeRows[j];
-			printf("\t%s\n", table->cells[row][col]);
+			printf("\t%s\n", table_getcell(table, row, col));
 		}
 	}
 }
 
 static void table_printinfo(Table *table)
 {
+	table_checkrows(table);
+	if (table_infertypes(table, table->activeCols,
+				table->numActiveCols) < 0)
+		fprintf(stderr, "error: %s\n", table_strerror(table));
 	printf("%zu %zu\n", table->numActiveCols, table->numActiveRows);
 	for (size_t i = 0; i < table->numActiveCols; i++) {
 		const size_t col = table->activeCols[i];
-		printf("%s\n", table->colNames[col]);
+		printf("%s\t%s\n", table->colNames[col], table_typename(
+					table->columns[col].type));
 	}
 }
 
@@ -330,247 +399,1419 @@ static int table_printbeautiful(Table *table)
 	return 0;
 }
 
-static int table_writeout(Table *table, const char *path)
+static bool table_isstdout(const char *path)
+{
+	return path == NULL || *path == '\0' || !strcmp(path, "-");
+}
+
+static bool table_ismapped(const Table *table, const struct stat *st)
 {
-	FILE *fp;
+	for (size_t i = 0; i < table->numMappings; i++)
+		if (table->mappings[i].dev == st->st_dev &&
+				table->mappings[i].ino == st->st_ino)
+			return true;
+	return false;
+}
+
+/* Creates a file next to the one path leads to, *pTemp is set to its
+ * name, which is the name of the file with TABLE_TEMP_SUFFIX added.
+ */
+#define TABLE_TEMP_SUFFIX ".XXXXXX"
+static int table_opentemp(const char *path, const struct stat *st,
+		char **pTemp)
+{
+	char *target, *temp;
+	size_t length;
+	int fd;
 
-	if (path != NULL && *path != '\0') {
-		fp = fopen(path, "w");
-		if (fp == NULL) {
+	target = realpath(path, NULL);
+	if (target == NULL)
+		return -1;
+	length = strlen(target);
+	temp = realloc(target, length + sizeof(TABLE_TEMP_SUFFIX));
+	if (temp == NULL) {
+		free(target);
+		return -1;
+	}
+	memcpy(&temp[length], TABLE_TEMP_SUFFIX, sizeof(TABLE_TEMP_SUFFIX));
+	fd = mkstemp(temp);
+	if (fd < 0) {
+		free(temp);
+		return -1;
+	}
+	fchmod(fd, st->st_mode & 07777);
+	*pTemp = temp;
+	return fd;
+}
+
+/* A file the table is mapped from can not be truncated, the rows not
+ * read yet would be gone. It is written under a temporary name instead,
+ * *pTemp, which table_closeoutput() renames over it.
+ */
+static int table_openoutput(const Table *table, Writer *writer,
+		const char *path, char **pTemp)
+{
+	struct stat st;
+	int fd;
+
+	*pTemp = NULL;
+	if (table_isstdout(path)) {
+		/* whatever was printed before comes first */
+		fflush(stdout);
+		fd = STDOUT_FILENO;
+	} else {
+		if (stat(path, &st) == 0 && table_ismapped(table, &st))
+			fd = table_opentemp(path, &st, pTemp);
+		else
+			fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+		if (fd < 0) {
 			fprintf(stderr, "unable to open '%s': %s\n",
 					path, strerror(errno));
 			return -1;
 		}
-	} else {
-		fp = stdout;
 	}
+	if (writer_open(writer, fd) < 0) {
+		fprintf(stderr, "unable to write '%s': %s\n",
+				table_isstdout(path) ? "stdout" : path,
+				strerror(errno));
+		if (fd != STDOUT_FILENO)
+			close(fd);
+		if (*pTemp != NULL) {
+			unlink(*pTemp);
+			free(*pTemp);
+		}
+		return -1;
+	}
+	return 0;
+}
 
-	for (size_t i = 0; i < table->numActiveCols; i++) {
-		const size_t col = table->activeCols[i];
-		if (i > 0)
-			fputc(';', fp);
-		fprintf(fp, "\"%s\"", table->colNames[col]);
+static int table_closeoutput(Writer *writer, const char *path, char *temp)
+{
+	int code;
+
+	code = writer_close(writer);
+	if (writer->fd != STDOUT_FILENO && close(writer->fd) < 0 &&
+			code == 0)
+		code = -1;
+	if (temp != NULL) {
+		char *target;
+
+		/* the file is only replaced when it was written whole */
+		target = strndup(temp, strlen(temp) -
+				(sizeof(TABLE_TEMP_SUFFIX) - 1));
+		if (code == 0 && (target == NULL ||
+					rename(temp, target) < 0))
+			code = -1;
+		if (code < 0)
+			unlink(temp);
+		free(target);
+		free(temp);
 	}
-	fputc('\n', fp);
+	if (code < 0)
+		fprintf(stderr, "unable to write '%s': %s\n",
+				table_isstdout(path) ? "stdout" : path,
+				strerror(errno));
+	return code;
+}
+
+static void table_writecell(Writer *writer, const Utf8 *cell, size_t index,
+		enum table_quote quote)
+{
+	size_t length;
+	bool quoted;
+
+	if (index > 0)
+		writer_putc(writer, ';');
+	length = strcspn(cell, ";,\t");
+	quoted = quote == TABLE_QUOTE_ALL || cell[length] != '\0' ||
+		cell[0] == '\"' ||
+		/* a row of one empty cell would be an empty line */
+		(index == 0 && cell[0] == '\0');
+	if (cell[length] != '\0')
+		length += strlen(&cell[length]);
+	if (quoted)
+		writer_putc(writer, '\"');
+	writer_write(writer, cell, length);
+	if (quoted)
+		writer_putc(writer, '\"');
+}
+
+static void table_writerow(Writer *writer, Utf8 *const *row,
+		const size_t *cols, size_t numCols, enum table_quote quote)
+{
+	for (size_t i = 0; i < numCols; i++)
+		table_writecell(writer, row[cols[i]], i, quote);
+	writer_putc(writer, '\n');
+}
+
+static void table_writeactiverows(Writer *writer, Table *table,
+		size_t begin, size_t end)
+{
+	for (size_t i = begin; i < end; i++) {
+		const size_t row = table->activeRows[i];
+		for (size_t j = 0; j < table->numActiveCols; j++)
+			table_writecell(writer, table_getcell(table, row,
+						table->activeCols[j]), j,
+					table->quote);
+		writer_putc(writer, '\n');
+	}
+}
+
+/* Active rows that one job formats at once when writing in parallel */
+#define TABLE_WRITE_CHUNK ((size_t) 16384)
+
+struct table_write_round {
+	Table *table;
+	/* first active row of the round */
+	size_t begin;
+	/* one memory writer per job */
+	Writer *chunks;
+};
+
+static void table_formatchunk(void *arg, size_t job)
+{
+	struct table_write_round *const round = arg;
+	Table *const table = round->table;
+
+	const size_t begin = MIN(round->begin + job * TABLE_WRITE_CHUNK,
+			table->numActiveRows);
+	const size_t end = MIN(begin + TABLE_WRITE_CHUNK,
+			table->numActiveRows);
+	round->chunks[job].length = 0;
+	table_writeactiverows(&round->chunks[job], table, begin, end);
+}
+
+/* The jobs format their chunks of a round into memory, which is then
+ * written in order, so the bytes are the same as when written by one
+ * thread. Returns -1 if there is not enough memory for the chunks.
+ */
+static int table_writeparallel(Writer *writer, Table *table)
+{
+	struct table_write_round round;
+	size_t numJobs;
+	int code = 0;
+
+	numJobs = MIN(table->numJobs, (table->numActiveRows +
+				TABLE_WRITE_CHUNK - 1) / TABLE_WRITE_CHUNK);
+	round.table = table;
+	round.chunks = calloc(numJobs, sizeof(*round.chunks));
+	if (round.chunks == NULL)
+		return -1;
+	for (size_t i = 0; i < numJobs; i++)
+		if (writer_openmemory(&round.chunks[i]) < 0) {
+			numJobs = i;
+			code = -1;
+			goto end;
+		}
+	for (round.begin = 0; round.begin < table->numActiveRows &&
+			writer->error == 0;
+			round.begin += numJobs * TABLE_WRITE_CHUNK) {
+		parallel_run(numJobs, table_formatchunk, &round);
+		for (size_t i = 0; i < numJobs; i++) {
+			if (round.chunks[i].error != 0) {
+				writer->error = round.chunks[i].error;
+				goto end;
+			}
+			writer_write(writer, round.chunks[i].buffer,
+					round.chunks[i].length);
+		}
+	}
+
+end:
+	for (size_t i = 0; i < numJobs; i++)
+		writer_close(&round.chunks[i]);
+	free(round.chunks);
+	return code;
+}
+
+/* Whether the active cols are all cols in their order, rows can then
+ * be written as they were read.
+ */
+static bool table_allcolsinorder(const Table *table)
+{
+	if (table->numActiveCols != table->numCols)
+		return false;
+	for (size_t i = 0; i < table->numActiveCols; i++)
+		if (table->activeCols[i] != i)
+			return false;
+	return true;
+}
+
+static const struct table_mapping *table_rowmapping(const Table *table,
+		size_t row)
+{
+	for (size_t i = table->numMappings; i > 0; i--)
+		if (table->mappings[i - 1].firstRow <= row)
+			return &table->mappings[i - 1];
+	return NULL;
+}
+
+/* A run of unchanged rows that follow each other in their file */
+struct table_run {
+	const struct table_mapping *mapping;
+	size_t start;
+	size_t end;
+	/* the last line of the file might have no line feed */
+	bool addNewline;
+};
+
+static void table_flushrun(Writer *writer, struct table_run *run)
+{
+	if (run->mapping == NULL)
+		return;
+	writer_copyfile(writer, run->mapping->fd, run->start,
+			run->end - run->start);
+	if (run->addNewline)
+		writer_putc(writer, '\n');
+	run->mapping = NULL;
+}
+
+/* Writes the active rows, unchanged rows are copied from their file,
+ * a run of them at once.
+ */
+static void table_writekept(Writer *writer, Table *table)
+{
+	struct table_run run = { NULL, 0, 0, false };
+
 	for (size_t i = 0; i < table->numActiveRows; i++) {
 		const size_t row = table->activeRows[i];
-		for (size_t j = 0; j < table->numActiveCols; j++) {
-			const size_t col = table->activeCols[j];
-			if (j > 0)
-				fputc(';', fp);
-			fprintf(fp, "\"%s\"", table->cells[row][col]);
+		const struct table_mapping *mapping;
+		const struct table_line *line;
+		size_t end, fileSize;
+		bool hasNewline;
+
+		mapping = table_rowmapping(table, row);
+		if (row >= table->numLines ||
+				table->lines[row].start == TABLE_NO_LINE ||
+				mapping == NULL || mapping->fd < 0) {
+			table_flushrun(writer, &run);
+			table_writeactiverows(writer, table, i, i + 1);
+			continue;
+		}
+		line = &table->lines[row];
+		/* the mapping has a spare byte behind the file */
+		fileSize = mapping->size - 1;
+		end = line->start + line->length;
+		hasNewline = end < fileSize;
+		if (run.mapping == mapping && run.end == line->start &&
+				!run.addNewline) {
+			run.end = end + hasNewline;
+			run.addNewline = !hasNewline;
+			continue;
+		}
+		table_flushrun(writer, &run);
+		run.mapping = mapping;
+		run.start = line->start;
+		run.end = end + hasNewline;
+		run.addNewline = !hasNewline;
+	}
+	table_flushrun(writer, &run);
+}
+
+static int table_writeout(Table *table, const char *path)
+{
+	Writer writer;
+	char *temp;
+	struct stat st;
+
+	table_checkrows(table);
+	if (table_openoutput(table, &writer, path, &temp) < 0)
+		return -1;
+	table_writerow(&writer, table->colNames, table->activeCols,
+			table->numActiveCols, table->quote);
+	/* rows are only copied from a file that is not also the output,
+	 * stdout can still be one of the input files
+	 */
+	if (table->quote == TABLE_QUOTE_KEEP && table_allcolsinorder(table) &&
+			(fstat(writer.fd, &st) < 0 ||
+			 !table_ismapped(table, &st)))
+		table_writekept(&writer, table);
+	/* the cells of lazy tables can only be read by one thread */
+	else if (table->numJobs <= 1 || table->lazy != NULL ||
+			table->numActiveRows <= TABLE_WRITE_CHUNK ||
+			table_writeparallel(&writer, table) < 0)
+		table_writeactiverows(&writer, table, 0,
+				table->numActiveRows);
+	return table_closeoutput(&writer, path, temp);
+}
+
+
+/* Parses all lines in [begin, end), end must be the end of the mapping
+ * or point right behind a line feed. *pNumLines counts every line of
+ * the file before the failing one or up to end, blank lines included,
+ * so that errors name the line of the file. On failure, *pLine is set
+ * to the line that could not be parsed.
+ */
+static int table_parsemappedlines(Table *table, char *begin, char *end,
+		size_t *pNumLines, char **pLine)
+{
+	char *line, *next, *newline;
+	size_t numLines = 0;
+
+	for (line = begin; line != end; line = next) {
+		newline = memchr(line, '\n', end - line);
+		if (newline == NULL) {
+			/* the mapping has a spare null byte behind the end */
+			newline = end;
+			next = end;
+		} else {
+			next = newline + 1;
+		}
+		if (newline == line) {
+			numLines++;
+			continue;
+		}
+		*newline = '\0';
+		if (table_parsemappedline(table, line, newline - line) < 0) {
+			*pNumLines = numLines;
+			*pLine = line;
+			return -1;
 		}
-		fputc('\n', fp);
+		numLines++;
+	}
+	*pNumLines = numLines;
+	return 0;
+}
+
+/* Chunks smaller than this are not worth a thread */
+#define TABLE_CHUNK_MIN ((size_t) 1 << 20)
+
+struct table_chunk {
+	/* holds the rows of this chunk until they are moved over */
+	Table table;
+	char *begin;
+	char *end;
+	size_t numLines;
+	char *errorLine;
+	int code;
+};
+
+static void table_parsechunk(void *arg, size_t job)
+{
+	struct table_chunk *const chunk = &((struct table_chunk*) arg)[job];
+
+	chunk->code = table_parsemappedlines(&chunk->table, chunk->begin,
+			chunk->end, &chunk->numLines, &chunk->errorLine);
+}
+
+/* Splits [begin, end) into chunks at line boundaries and parses them on
+ * table->numJobs threads. A line is always a whole record because
+ * quoted cells can not span lines, so any line feed is a safe place to
+ * split. The rows are moved into the table in file order and errors
+ * are reported like the serial loop would: only the first one, with
+ * the same line number, and the rows before it are kept.
+ */
+static int table_parsechunks(Table *table, char *begin, char *end,
+		size_t numChunks, size_t lineIndex)
+{
+	struct table_chunk *chunks;
+	int code;
+
+	chunks = calloc(numChunks, sizeof(*chunks));
+	if (chunks == NULL) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
+		return -1;
+	}
+	for (size_t i = 0; i < numChunks; i++) {
+		struct table_chunk *const chunk = &chunks[i];
+
+		if (table_initlike(&chunk->table, table) < 0) {
+			fprintf(stderr, "error: %s\n",
+					table_strerror(&chunk->table));
+			while (i > 0)
+				table_uninit(&chunks[--i].table);
+			table_uninit(&chunk->table);
+			free(chunks);
+			return -1;
+		}
+		chunk->begin = i == 0 ? begin : chunks[i - 1].end;
+		if (i + 1 == numChunks) {
+			chunk->end = end;
+		} else {
+			char *split, *newline;
+
+			split = begin + (end - begin) / numChunks * (i + 1);
+			split = MAX(split, chunk->begin);
+			newline = memchr(split, '\n', end - split);
+			chunk->end = newline == NULL ? end : newline + 1;
+		}
+	}
+
+	parallel_run(numChunks, table_parsechunk, chunks);
+
+	code = 0;
+	for (size_t i = 0; i < numChunks; i++) {
+		struct table_chunk *const chunk = &chunks[i];
+
+		if (code < 0) {
+			table_uninit(&chunk->table);
+			continue;
+		}
+		if (chunk->code < 0) {
+			memcpy(table->error, chunk->table.error,
+					sizeof(table->error));
+			table->atText = chunk->table.atText;
+			table_printparseerror(table, lineIndex +
+					chunk->numLines, chunk->errorLine);
+			code = -1;
+		}
+		if (table_takerows(table, &chunk->table) < 0) {
+			fprintf(stderr, "error: %s\n", table_strerror(table));
+			table_uninit(&chunk->table);
+			code = -1;
+		}
+		lineIndex += chunk->numLines;
+	}
+	free(chunks);
+	return code;
+}
+
+/* Reads the file without copying it, the lines are terminated in
+ * place and the columns point directly into the private mapping.
+ */
+static int table_mapin(Table *table, int fd, const struct stat *st)
+{
+	const size_t size = st->st_size;
+	char *data;
+	char *begin, *end;
+	char *errorLine;
+	size_t lineIndex, numLines;
+	size_t numChunks;
+	size_t firstLine = 0;
+
+	/* one byte more than the file is reserved so that the last line
+	 * can always be terminated in place, the part behind the file is
+	 * backed by anonymous memory
+	 */
+	data = mmap(NULL, size + 1, PROT_READ | PROT_WRITE,
+			MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (data == MAP_FAILED)
+		return 1;
+	if (mmap(data, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED,
+				fd, 0) == MAP_FAILED) {
+		munmap(data, size + 1);
+		return 1;
+	}
+	if (table_addmapping(table, data, size + 1, st) < 0) {
+		munmap(data, size + 1);
+		fprintf(stderr, "error: %s\n", table_strerror(table));
+		return -1;
+	}
+	/* unchanged rows are copied from the file when writing */
+	if (table->quote == TABLE_QUOTE_KEEP)
+		table->mappings[table->numMappings - 1].fd = dup(fd);
+	posix_madvise(data, size, POSIX_MADV_SEQUENTIAL);
+
+	lineIndex = 0;
+	begin = data;
+	end = data + size;
+	if (table->colNames == NULL) {
+		char *newline;
+
+		while (begin != end && *begin == '\n')
+			begin++;
+		lineIndex = begin - data;
+		/* the blank lines and the header */
+		firstLine = lineIndex + 1;
+		newline = memchr(begin, '\n', end - begin);
+		newline = newline == NULL ? end : newline + 1;
+		if (table_parsemappedlines(table, begin, newline, &numLines,
+					&errorLine) < 0) {
+			table_printparseerror(table, lineIndex, errorLine);
+			return -1;
+		}
+		lineIndex += numLines;
+		begin = newline;
+	}
+
+	if (table->useLazy && table->numRows == 0 && table->lazy == NULL) {
+		if (table_setlazy(table, begin, end, firstLine) < 0) {
+			fprintf(stderr, "error: %s\n", table_strerror(table));
+			return -1;
+		}
+		return 0;
+	}
+
+	numChunks = MIN(table->numJobs, (size_t) (end - begin) /
+			TABLE_CHUNK_MIN);
+	if (numChunks > 1)
+		return table_parsechunks(table, begin, end, numChunks,
+				lineIndex);
+	if (table_parsemappedlines(table, begin, end, &numLines,
+				&errorLine) < 0) {
+		table_printparseerror(table, lineIndex + numLines, errorLine);
+		return -1;
 	}
-	if (fp != stdout)
-		fclose(fp);
 	return 0;
 }
 
 static int table_readin(Table *table, const char *path)
 {
-	FILE *fp;
-	char *line = NULL;
-	size_t capacity;
-	ssize_t count;
+	int fd;
+	struct stat st;
+	Reader reader;
+	char *line;
+	size_t length;
 	size_t lineIndex;
+	int code;
 
-	fp = fopen(path, "r");
-	if (fp == NULL) {
+	/* the cells are about to change */
+	table_waitindex(table);
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
 		fprintf(stderr, "unable to open '%s': %s\n",
 				path, strerror(errno));
 		return -1;
 	}
+	if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		/* a snapshot holds exactly one file, so it can only be used
+		 * for the first one
+		 */
+		const bool useCache = table->useCache &&
+			table->colNames == NULL;
+		if (useCache) {
+			code = table_loadcache(table, path, &st);
+			if (code <= 0) {
+				close(fd);
+				return code;
+			}
+		}
+		code = table_mapin(table, fd, &st);
+		if (code == 0 && table_encodecolumns(table) < 0) {
+			fprintf(stderr, "error: %s\n", table_strerror(table));
+			code = -1;
+		}
+		if (code == 0 && useCache && table->lazy == NULL)
+			table_savecache(table, path, &st);
+		if (code <= 0) {
+			close(fd);
+			return code;
+		}
+	}
+
+	/* fall back to reading line by line when the file can not be
+	 * mapped, for example when it is a pipe
+	 */
+	if (reader_open(&reader, fd) < 0) {
+		fprintf(stderr, "unable to read '%s': %s\n",
+				path, strerror(errno));
+		close(fd);
+		return -1;
+	}
+	code = 0;
 	lineIndex = 0;
-	while ((count = getline(&line, &capacity, fp)) >= 0) {
-		if (count <= 1)
+	for (; (line = reader_getline(&reader, &length)) != NULL;
+			lineIndex++) {
+		if (length == 0)
 			continue;
-		line[count - 1] = '\0';
 		if (table_parseline(table, line) < 0) {
-			fprintf(stderr, " at line no. %zu\n%s\n",
-					lineIndex + 1, line);
-			if (table->atText != NULL) {
-				for (char *s = line; s != table->atText; s++)
-					fprintf(stderr, "~");
-				fprintf(stderr, "^\n");
-			}
-			free(line);
-			fclose(fp);
-			return -1;
+			table_printparseerror(table, lineIndex, line);
+			code = -1;
+			break;
 		}
-		lineIndex++;
 	}
-	free(line);
-	fclose(fp);
-	return 0;
+	if (reader.error != 0) {
+		fprintf(stderr, "unable to read '%s': %s\n",
+				path, strerror(reader.error));
+		code = -1;
+	}
+	if (code == 0 && table_encodecolumns(table) < 0) {
+		fprintf(stderr, "error: %s\n", table_strerror(table));
+		code = -1;
+	}
+	reader_close(&reader);
+	close(fd);
+	return code;
 }
 
 static void table_allrows(Table *table)
 {
-	for (size_t i = 0; i < table->numRows; i++)
-		table->newActiveRows[i] = i;
-	table->newNumActiveRows = table->numRows;
+	table_invertset(table->newRowSet, NULL, table->numRows);
 }
 
 static void table_allcols(Table *table)
 {
-	for (size_t i = 0; i < table->numCols; i++)
-		table->newActiveCols[i] = i;
-	table->newNumActiveCols = table->numCols;
+	table_invertset(table->newColSet, NULL, table->numCols);
 }
 
 static void table_invertrows(Table *table)
 {
-	for (size_t i = 0, j = 0; i < table->numRows; i++) {
-		size_t k;
+	table_invertset(table->newRowSet, table->rowSet, table->numRows);
+}
 
-		for (k = 0; k < table->numActiveRows; k++)
-			if (table->activeRows[k] == i)
-				break;
-		if (k != table->numActiveRows)
-			continue;
-		table->newActiveRows[j++] = i;
+static void table_invertcols(Table *table)
+{
+	table_invertset(table->newColSet, table->colSet, table->numCols);
+}
+
+/* Rows that one job matches at least when selecting in parallel */
+#define TABLE_MATCH_CHUNK ((size_t) 16384)
+
+/* What the jobs of table_matchrows() share. Each job tests its own part
+ * of the rows and adds those that match to newRowSet.
+ */
+struct table_match {
+	Table *table;
+	const Pattern *pattern;
+	/* the columns that are tested */
+	const size_t *cols;
+	size_t numCols;
+	/* NULL for all rows of the table */
+	const size_t *rows;
+	size_t numRows;
+	size_t numJobs;
+	/* for each column that is encoded whether the cell of each code
+	 * matches, NULL for the other columns
+	 */
+	bool **matchedCodes;
+	bool matchedEmpty;
+	bool *matched;
+};
+
+/* Matches every distinct cell of an encoded column once, the rows
+ * then only look up the result of their code. Returns NULL when there
+ * is no memory for it.
+ */
+static bool *table_matchcodes(const struct table_column *column,
+		const Pattern *pattern)
+{
+	bool *matchedCodes;
+
+	matchedCodes = malloc(sizeof(*matchedCodes) *
+			MAX(column->numDict, (size_t) 1));
+	if (matchedCodes == NULL)
+		return NULL;
+	for (size_t k = 0; k < column->numDict; k++)
+		matchedCodes[k] = pattern_match(pattern,
+				column->dict[k] == TABLE_EMPTY_CELL ? "" :
+					&column->text[column->dict[k]]);
+	return matchedCodes;
+}
+
+/* The text of a column or the lines of a stream are only searched for
+ * the literal of a pattern while at most one in this many contains it,
+ * that is checked after this many.
+ */
+#define TABLE_LITERAL_RATIO ((size_t) 8)
+#define TABLE_LITERAL_SAMPLE ((size_t) 4096)
+
+/* Returns the end of the text the cells of the column are in, NULL if
+ * it is not known or holds more than the column. The cells of a column
+ * borrowed from a file with several columns are spread over the whole
+ * file, searching it would go through the other columns as well.
+ */
+static const char *table_textend(const Table *table,
+		const struct table_column *column)
+{
+	if (column->capText > 0 || column->lenText > 0)
+		return &column->text[column->lenText];
+	if (table->numCols > 1)
+		return NULL;
+	for (size_t i = 0; i < table->numMappings; i++) {
+		const struct table_mapping *const mapping = &table->mappings[i];
+		if (column->text >= mapping->data &&
+				column->text < &mapping->data[mapping->size])
+			return &mapping->data[mapping->size];
 	}
-	table->newNumActiveRows = table->numRows - table->numActiveRows;
+	return NULL;
 }
 
-static void table_invertcols(Table *table)
+/* Searches the literal of the pattern through the text of the column
+ * instead of cell by cell, only the cells it is found in are matched.
+ * A search starts at the cell that needs it and its result is reused
+ * by the cells before the occurrence, so cells that are in text order
+ * are searched in one pass. The others are matched on their own, as
+ * are all cells once the literal turns out to be in too many of them.
+ */
+static void table_matchtext(const struct table_match *match, size_t col,
+		const char *textEnd, size_t begin, size_t end)
 {
-	for (size_t i = 0, j = 0; i < table->numCols; i++) {
-		size_t k;
+	const struct table_column *const column =
+		&match->table->columns[col];
+	const Pattern *const pattern = match->pattern;
+	bool *const matched = match->matched;
+	/* where the last search started and what it found, textEnd if
+	 * nothing
+	 */
+	const char *searched = NULL, *found = NULL;
+	size_t numFound = 0;
+	bool sampled = false, perCell = false;
+
+	for (size_t j = begin; j < end; j++) {
+		const size_t row = match->rows == NULL ? j : match->rows[j];
+		const size_t *pOffset;
+		const char *cell;
 
-		for (k = 0; k < table->numActiveCols; k++)
-			if (table->activeCols[k] == i)
-				break;
-		if (k != table->numActiveCols)
+		if (!sampled && j - begin >= TABLE_LITERAL_SAMPLE) {
+			sampled = true;
+			perCell = numFound > TABLE_LITERAL_SAMPLE /
+				TABLE_LITERAL_RATIO;
+		}
+		if (matched[j])
+			continue;
+		if (row >= column->numOffsets ||
+				column->offsets[row] == TABLE_EMPTY_CELL) {
+			matched[j] = match->matchedEmpty;
 			continue;
-		table->newActiveCols[j++] = i;
+		}
+		pOffset = &column->offsets[row];
+		cell = table_offsetcell(column->text, pOffset);
+		if (perCell || table_isinline(*pOffset) ||
+				(searched != NULL && cell < searched)) {
+			matched[j] = pattern_match(pattern, cell);
+			continue;
+		}
+		if (searched == NULL || found < cell) {
+			searched = cell;
+			found = scan_find(cell, textEnd - cell,
+					pattern->literal, pattern->lenLiteral);
+			if (found == NULL)
+				found = textEnd;
+		}
+		/* the occurrence is in a later cell if this one ends first */
+		if (found == textEnd ||
+				memchr(cell, '\0', found - cell) != NULL)
+			continue;
+		numFound++;
+		matched[j] = pattern_match(pattern, cell);
 	}
-	table->newNumActiveCols = table->numCols - table->numActiveCols;
 }
 
-static void table_filterrows(Table *table, const Utf8 *filter)
+static void table_matchpart(void *arg, size_t job)
 {
-	if (table->numActiveRows > 0) {
-		table->newNumActiveRows = 0;
-		for (size_t i = 0; i < table->numActiveRows; i++) {
-			const size_t row = table->activeRows[i];
-			for (size_t j = 0; j < table->numActiveCols; j++) {
-				const size_t col = table->activeCols[j];
-				if (!utf8_match(filter,
-						table->cells[row][col]))
+	struct table_match *const match = arg;
+	Table *const table = match->table;
+	const Pattern *const pattern = match->pattern;
+	bool *const matched = match->matched;
+	const size_t begin = match->numRows * job / match->numJobs;
+	const size_t end = match->numRows * (job + 1) / match->numJobs;
+	size_t word = 0;
+	uint64_t bits = 0;
+
+	if (table->lazy != NULL) {
+		/* row by row instead, so that every row is parsed once */
+		for (size_t j = begin; j < end; j++) {
+			const size_t row = match->rows == NULL ? j :
+				match->rows[j];
+			for (size_t i = 0; i < match->numCols; i++)
+				if (pattern_match(pattern, table_getcell(table,
+							row, match->cols[i]))) {
+					matched[j] = true;
+					break;
+				}
+		}
+	}
+	for (size_t i = 0; table->lazy == NULL && i < match->numCols; i++) {
+		const size_t col = match->cols[i];
+		const struct table_column *const column = &table->columns[col];
+		const bool *const matchedCodes = match->matchedCodes[i];
+		const char *textEnd;
+
+		if (matchedCodes != NULL) {
+			for (size_t j = begin; j < end; j++) {
+				const size_t row = match->rows == NULL ? j :
+					match->rows[j];
+				if (matched[j])
 					continue;
-				table->newActiveRows
-					[table->newNumActiveRows++] = row;
-				break;
+				/* cells behind the codes are empty */
+				matched[j] = row < column->numOffsets ?
+					matchedCodes[table_getcode(column,
+							row)] :
+					match->matchedEmpty;
 			}
+			continue;
 		}
-	} else {
-		table_selectrows(table, filter);
+		/* exact patterns are quicker to compare per cell */
+		if (pattern->literal != NULL &&
+				pattern->alternatives[0].kind == PATTERN_GLOB &&
+				(textEnd = table_textend(table, column)) !=
+				NULL) {
+			table_matchtext(match, col, textEnd, begin, end);
+			continue;
+		}
+		for (size_t j = begin; j < end; j++) {
+			if (matched[j])
+				continue;
+			matched[j] = pattern_match(pattern,
+				table_getcell(table, match->rows == NULL ? j :
+					match->rows[j], col));
+		}
+	}
+
+	/* the rows are ascending, so the bits of a word are gathered
+	 * first, only the words at the ends of a part are shared
+	 */
+	for (size_t j = begin; j < end; j++) {
+		const size_t row = match->rows == NULL ? j : match->rows[j];
+
+		if (!matched[j])
+			continue;
+		if (row / 64 != word && bits != 0) {
+			__atomic_fetch_or(&table->newRowSet[word], bits,
+					__ATOMIC_RELAXED);
+			bits = 0;
+		}
+		word = row / 64;
+		bits |= (uint64_t) 1 << (row % 64);
+	}
+	if (bits != 0)
+		__atomic_fetch_or(&table->newRowSet[word], bits,
+				__ATOMIC_RELAXED);
+}
+
+/* Keeps the rows that have a cell in at least one of the columns cols
+ * matching the filter, rows is NULL to test all rows of the table. The
+ * filter is compiled once and the cells are tested column by column so
+ * that each pass runs over one contiguous offsets array. Large tables
+ * are split into parts that are tested in parallel.
+ */
+static void table_matchrows(Table *table, const Utf8 *filter,
+		const size_t *cols, size_t numCols,
+		const size_t *rows, size_t numRows)
+{
+	Pattern pattern;
+	struct table_match match;
+	size_t *candidates = NULL, numCandidates;
+
+	if (pattern_compile(&pattern, filter) < 0) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
+		table_copyset(table->newRowSet, table->rowSet, table->numRows);
+		return;
+	}
+	/* exact patterns are looked up in the hashes of the columns */
+	table_clearset(table->newRowSet, table->numRows);
+	if (table_hashrows(table, &pattern, cols, numCols, rows, numRows,
+				table->newRowSet) == 0) {
+		pattern_free(&pattern);
+		return;
+	}
+	/* only the rows the index can not rule out are tested */
+	if (table_indexcandidates(table, &pattern, cols, numCols,
+				rows, numRows, &candidates, &numCandidates) == 0) {
+		rows = candidates;
+		numRows = numCandidates;
 	}
+	match.table = table;
+	match.pattern = &pattern;
+	match.cols = cols;
+	match.numCols = numCols;
+	match.rows = rows;
+	match.numRows = numRows;
+	/* the cells of lazy tables can only be read by one thread */
+	match.numJobs = table->lazy != NULL ? 1 :
+		MAX(MIN(table->numJobs, numRows / TABLE_MATCH_CHUNK),
+				(size_t) 1);
+	match.matchedCodes = calloc(MAX(numCols, (size_t) 1),
+			sizeof(*match.matchedCodes));
+	match.matchedEmpty = pattern_match(&pattern, "");
+	match.matched = calloc(MAX(numRows, (size_t) 1),
+			sizeof(*match.matched));
+	if (match.matchedCodes == NULL || match.matched == NULL) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
+		table_copyset(table->newRowSet, table->rowSet, table->numRows);
+		goto end;
+	}
+	/* without memory for the results of the codes the cells are
+	 * matched themselves
+	 */
+	for (size_t i = 0; table->lazy == NULL && i < numCols; i++) {
+		const struct table_column *const column =
+			&table->columns[cols[i]];
+		if (column->codes != NULL)
+			match.matchedCodes[i] = table_matchcodes(column,
+					&pattern);
+	}
+
+	table_clearset(table->newRowSet, table->numRows);
+	if (match.numJobs > 1)
+		parallel_run(match.numJobs, table_matchpart, &match);
+	else
+		table_matchpart(&match, 0);
+
+end:
+	if (match.matchedCodes != NULL)
+		for (size_t i = 0; i < numCols; i++)
+			free(match.matchedCodes[i]);
+	free(match.matchedCodes);
+	free(match.matched);
+	free(candidates);
+	pattern_free(&pattern);
+}
+
+static void table_filterrows(Table *table, const Utf8 *filter)
+{
+	if (table->numActiveRows > 0)
+		table_matchrows(table, filter, table->activeCols,
+				table->numActiveCols, table->activeRows,
+				table->numActiveRows);
+	else
+		table_selectrows(table, filter);
 }
 
 static void table_selectrows(Table *table, const Utf8 *filter)
 {
-	table->newNumActiveRows = 0;
-	for (size_t row = 0; row < table->numRows; row++) {
-		for (size_t j = 0; j < table->numActiveCols; j++) {
-			const size_t col = table->activeCols[j];
-			if (!utf8_match(filter,
-					table->cells[row][col]))
-				continue;
-			table->newActiveRows[table->newNumActiveRows++] = row;
-			break;
-		}
+	table_matchrows(table, filter, table->activeCols,
+			table->numActiveCols, NULL, table->numRows);
+}
+
+/* Keeps the columns whose name matches the filter, cols is NULL to test
+ * all columns of the table.
+ */
+static void table_matchcols(Table *table, const Utf8 *filter,
+		const size_t *cols, size_t numCols)
+{
+	Pattern pattern;
+
+	if (pattern_compile(&pattern, filter) < 0) {
+		fprintf(stderr, "error: %s\n", strerror(errno));
+		table_copyset(table->newColSet, table->colSet, table->numCols);
+		return;
+	}
+	table_clearset(table->newColSet, table->numCols);
+	for (size_t i = 0; i < numCols; i++) {
+		const size_t col = cols == NULL ? i : cols[i];
+		if (pattern_match(&pattern, table->colNames[col]))
+			table_addtoset(table->newColSet, col);
 	}
+	pattern_free(&pattern);
 }
 
 static void table_filtercols(Table *table, const Utf8 *filter)
 {
-	if (table->numActiveCols > 0) {
-		table->newNumActiveCols = 0;
-		for (size_t i = 0; i < table->numActiveCols; i++) {
-			const size_t col = table->activeCols[i];
-			if (utf8_match(filter, table->colNames[col]))
-				table->newActiveCols
-					[table->newNumActiveCols++] = col;
-		}
-	} else {
+	if (table->numActiveCols > 0)
+		table_matchcols(table, filter, table->activeCols,
+				table->numActiveCols);
+	else
 		table_selectcols(table, filter);
-	}
 }
 
 static void table_selectcols(Table *table, const Utf8 *filter)
 {
-	table->newNumActiveCols = 0;
-	for (size_t col = 0; col < table->numCols; col++)
-		if (utf8_match(filter, table->colNames[col]))
-			table->newActiveCols[table->newNumActiveCols++] = col;
+	table_matchcols(table, filter, NULL, table->numCols);
 }
 
-static int table_appendcol(Table *table, const Utf8 *name)
+/* Puts the rows whose cell in the column passes the test of the
+ * predicate into newRowSet: "=PATTERN" matches the text, "<N", "<=N",
+ * ">N" and ">=N" compare the native values of a numeric column.
+ */
+static void table_testwhere(Table *table, const char *test, size_t col,
+		const size_t *rows, size_t numRows)
 {
-	Utf8 **newColumnNames;
-	size_t *newActiveCols;
+	if (*test == '=') {
+		table_matchrows(table, test + 1, &col, 1, rows, numRows);
+		return;
+	}
+	table_clearset(table->newRowSet, table->numRows);
+	if (table_comparerows(table, col, test, rows, numRows,
+				table->newRowSet) < 0) {
+		fprintf(stderr, "error: %s\n", table_strerror(table));
+		table_copyset(table->newRowSet, table->rowSet, table->numRows);
+	}
+}
 
-	newColumnNames = realloc(table->colNames,
-			sizeof(*table->colNames) * (table->numCols + 1));
-	if (newColumnNames == NULL)
-		return -1;
-	table->colNames = newColumnNames;
-	table->colNames[table->numCols] = strdup(name);
-	if (table->colNames[table->numCols] == NULL)
-		return -1;
-	for (size_t i = 0; i < table->numRows; i++) {
-		char **newCells;
+/* Selects the rows whose cell in the column of the predicate passes its
+ * test, COL=PATTERN or a comparison like COL>=N, only that column is
+ * tested. The rows replace the selected rows, are intersected with them
+ * (AND_WHERE) or are added to them (OR_WHERE).
+ */
+static void table_whererows(Table *table, enum table_operation operation,
+		const Utf8 *predicate)
+{
+	const char *test;
+	size_t col;
 
-		newCells = realloc(table->cells[i], sizeof(*table->cells[i]) *
-				(table->numCols + 1));
-		if (newCells == NULL)
-			return -1;
-		table->cells[i] = newCells;
-		table->cells[i][table->numCols] = strdup("");
-		if (table->cells[i][table->numCols] == NULL) {
-			while (i > 0) {
-				i--;
-				free(table->cells[i][table->numCols]);
-			}
-			return -1;
-		}
+	table_copyset(table->newColSet, table->colSet, table->numCols);
+	test = &predicate[strcspn(predicate, "=<>")];
+	if (*test == '\0') {
+		fprintf(stderr, "error: expected COL=PATTERN, COL<N or COL>N "
+				"instead of '%s'\n", predicate);
+		table_copyset(table->newRowSet, table->rowSet, table->numRows);
+		return;
 	}
-	newActiveCols = realloc(table->activeCols,
-			sizeof(*table->activeCols) *
-				(table->numCols + 1));
-	if (newActiveCols == NULL)
-		return -1;
-	table->activeCols = newActiveCols;
+	for (col = 0; col < table->numCols; col++)
+		if (!strncmp(table->colNames[col], predicate,
+					test - predicate) &&
+				table->colNames[col][test - predicate] == '\0')
+			break;
+	if (col == table->numCols) {
+		fprintf(stderr, "error: there is no column '%.*s'\n",
+				(int) (test - predicate), predicate);
+		table_copyset(table->newRowSet, table->rowSet, table->numRows);
+		return;
+	}
+
+	switch (operation) {
+	case TABLE_OPERATION_AND_WHERE:
+		/* unlike --row, nothing stays nothing */
+		table_testwhere(table, test, col, table->activeRows,
+				table->numActiveRows);
+		break;
+	case TABLE_OPERATION_OR_WHERE:
+		table_testwhere(table, test, col, NULL, table->numRows);
+		for (size_t i = 0; i < TABLE_SET_WORDS(table->numRows); i++)
+			table->newRowSet[i] |= table->rowSet[i];
+		break;
+	default:
+		table_testwhere(table, test, col, NULL, table->numRows);
+	}
+}
+
+/* Applies the diff at index of the history, it might have to be read
+ * back from the spill file first.
+ */
+static int table_applyhistory(Table *table, size_t index)
+{
+	struct table_diff diff;
+	int loaded;
 
-	newActiveCols = realloc(table->newActiveCols,
-			sizeof(*table->newActiveCols) *
-				(table->numCols + 1));
-	if (newActiveCols == NULL)
+	loaded = table_loaddiff(table, index, &diff);
+	if (loaded < 0) {
+		fprintf(stderr, "error: %s\n", table_strerror(table));
 		return -1;
-	table->newActiveCols = newActiveCols;
-	table->numCols++;
+	}
+	table_applydiff(table, &diff);
+	if (loaded > 0)
+		table_freediff(&diff);
 	return 0;
 }
 
 static void table_undo(Table *table)
 {
-	struct table_diff *diff;
-
 	if (table->indexHistory == 0)
 		return;
-	diff = &table->history[--table->indexHistory];
-	table_applydiff(table, diff);
+	if (table_applyhistory(table, table->indexHistory - 1) == 0)
+		table->indexHistory--;
 }
 
 static void table_redo(Table *table)
 {
-	struct table_diff *diff;
-
 	if (table->indexHistory == table->numHistory)
 		return;
-	diff = &table->history[table->indexHistory++];
-	table_applydiff(table, diff);
+	if (table_applyhistory(table, table->indexHistory) == 0)
+		table->indexHistory++;
+}
+
+static int table_setquote(Table *table, const char *arg)
+{
+	if (!strcmp(arg, "all")) {
+		table->quote = TABLE_QUOTE_ALL;
+	} else if (!strcmp(arg, "minimal")) {
+		table->quote = TABLE_QUOTE_MINIMAL;
+	} else if (!strcmp(arg, "keep")) {
+		table->quote = TABLE_QUOTE_KEEP;
+	} else {
+		fprintf(stderr, "error: invalid quoting '%s', "
+				"expected 'all', 'minimal' or 'keep'\n", arg);
+		return -1;
+	}
+	return 0;
+}
+
+static int table_setjobs(Table *table, const char *arg)
+{
+	unsigned long numJobs;
+	char *end;
+
+	numJobs = strtoul(arg, &end, 10);
+	if (*arg == '\0' || *end != '\0' || numJobs == 0) {
+		fprintf(stderr, "error: invalid number of jobs '%s'\n", arg);
+		return -1;
+	}
+	table->numJobs = numJobs;
+	return 0;
+}
+
+static int table_sethistorymem(Table *table, const char *arg)
+{
+	unsigned long long size;
+	char *end;
+	unsigned shift = 0;
+
+	errno = 0;
+	size = strtoull(arg, &end, 10);
+	switch (*end) {
+	case 'k':
+	case 'K':
+		shift = 10;
+		end++;
+		break;
+	case 'm':
+	case 'M':
+		shift = 20;
+		end++;
+		break;
+	case 'g':
+	case 'G':
+		shift = 30;
+		end++;
+		break;
+	}
+	if (!isdigit((unsigned char) *arg) || *end != '\0' ||
+			errno == ERANGE || size > (SIZE_MAX >> shift)) {
+		fprintf(stderr, "error: invalid history size '%s'\n", arg);
+		return -1;
+	}
+	table->historyMem = size << shift;
+	return 0;
+}
+
+/* how the rows are selected at the end of a streamed command line */
+enum table_stream_rows {
+	TABLE_STREAM_NONE,
+	TABLE_STREAM_ALL,
+	TABLE_STREAM_MATCHING,
+};
+
+/* Returns one of enum table_stream_rows or -1 if the selections can not
+ * be streamed.
+ */
+static int
+table_streamrows(const struct table_command *commands, size_t numCommands)
+{
+	enum table_stream_rows rows = TABLE_STREAM_NONE;
+
+	for (size_t i = 0; i < numCommands; i++)
+		switch (commands[i].operation) {
+		case TABLE_OPERATION_ALL:
+		case TABLE_OPERATION_ALL_ROWS:
+			rows = TABLE_STREAM_ALL;
+			break;
+		case TABLE_OPERATION_NONE:
+		case TABLE_OPERATION_NO_ROWS:
+			rows = TABLE_STREAM_NONE;
+			break;
+		case TABLE_OPERATION_ALL_COLS:
+		case TABLE_OPERATION_NO_COLS:
+		case TABLE_OPERATION_COL:
+		case TABLE_OPERATION_SET_COL:
+			break;
+		case TABLE_OPERATION_ROW:
+			/* filtering a filtered selection depends on whether
+			 * any row matched the first time, which is only
+			 * known at the very end
+			 */
+			if (rows == TABLE_STREAM_MATCHING)
+				return -1;
+			rows = TABLE_STREAM_MATCHING;
+			break;
+		case TABLE_OPERATION_SET_ROW:
+			rows = TABLE_STREAM_MATCHING;
+			break;
+		default:
+			return -1;
+		}
+	return rows;
+}
+
+int table_stream(Table *table, const struct table_command *commands,
+		size_t numCommands)
+{
+	const struct table_command *output;
+	int rows;
+	Table header;
+	int fd;
+	struct stat st, outSt;
+	Reader reader;
+	Writer writer;
+	char *temp;
+	bool prefilter;
+	size_t numTested = 0, numFound = 0;
+	bool keepLines, keepLine;
+	char *keptLine = NULL;
+	size_t capKeptLine = 0;
+	char *line;
+	size_t length;
+	size_t lineIndex;
+	const Utf8 *filter = NULL;
+	Pattern pattern;
+	bool compiled = false;
+	size_t *patternCols = NULL;
+	size_t numPatternCols = 0;
+	Utf8 **row = NULL;
+	int code = -1;
+
+	/* with --cache, loading the snapshot is faster than reading */
+	if (numCommands < 2 || table->colNames != NULL || table->useCache ||
+			commands[0].operation != TABLE_OPERATION_INPUT)
+		return 1;
+	output = &commands[numCommands - 1];
+	if (output->operation != TABLE_OPERATION_OUTPUT &&
+			output->operation != TABLE_OPERATION_PRINT)
+		return 1;
+	rows = table_streamrows(&commands[1], numCommands - 2);
+	if (rows < 0)
+		return 1;
+
+	fd = open(commands[0].arg, O_RDONLY);
+	if (fd < 0)
+		return 1;
+	/* Whether printing can be streamed is only known after the
+	 * header, the fallback has to read it again then, which is not
+	 * possible for pipes.
+	 */
+	if (output->operation == TABLE_OPERATION_PRINT &&
+			(fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))) {
+		close(fd);
+		return 1;
+	}
+	/* the file would be truncated while it is read, loading it
+	 * first writes the output under another name
+	 */
+	if (output->operation == TABLE_OPERATION_OUTPUT &&
+			!table_isstdout(output->arg) &&
+			stat(output->arg, &outSt) == 0 &&
+			fstat(fd, &st) == 0 && st.st_dev == outSt.st_dev &&
+			st.st_ino == outSt.st_ino) {
+		close(fd);
+		return 1;
+	}
+	if (reader_open(&reader, fd) < 0) {
+		close(fd);
+		return 1;
+	}
+
+	/* the column selection only depends on the header, it is
+	 * found by running the commands on a table without rows
+	 */
+	table_init(&header);
+	header.numJobs = table->numJobs;
+	lineIndex = 0;
+	while ((line = reader_getline(&reader, &length)) != NULL) {
+		lineIndex++;
+		if (length == 0)
+			continue;
+		if (table_parseline(&header, line) < 0) {
+			table_printparseerror(&header, lineIndex - 1, line);
+			goto end;
+		}
+		break;
+	}
+	for (size_t i = 1; i < numCommands - 1; i++) {
+		const enum table_operation operation = commands[i].operation;
+		if (operation == TABLE_OPERATION_ROW ||
+				operation == TABLE_OPERATION_SET_ROW) {
+			filter = commands[i].arg;
+			patternCols = arena_realloc(&header.arena, patternCols,
+					sizeof(*patternCols) * numPatternCols,
+					sizeof(*patternCols) *
+						header.numActiveCols);
+			if (header.numActiveCols > 0 && patternCols == NULL)
+				goto end;
+			memcpy(patternCols, header.activeCols,
+					sizeof(*patternCols) *
+						header.numActiveCols);
+			numPatternCols = header.numActiveCols;
+		}
+		table_dooperation(&header, operation, commands[i].arg);
+	}
+	if (output->operation == TABLE_OPERATION_PRINT &&
+			header.numActiveCols != 1) {
+		/* printing column by column needs the whole table */
+		code = 1;
+		goto end;
+	}
+
+	if (table_openoutput(&header, &writer, output->arg, &temp) < 0)
+		goto end;
+	if (output->operation == TABLE_OPERATION_OUTPUT)
+		table_writerow(&writer, header.colNames, header.activeCols,
+				header.numActiveCols, table->quote);
+	row = arena_alloc(&header.arena, sizeof(*row) * header.numCols);
+	if (row == NULL)
+		goto end_out;
+	if (filter != NULL) {
+		if (pattern_compile(&pattern, filter) < 0) {
+			fprintf(stderr, "error: %s\n", strerror(errno));
+			goto end_out;
+		}
+		compiled = true;
+	}
+	prefilter = rows == TABLE_STREAM_MATCHING && pattern.literal != NULL;
+	keepLines = output->operation == TABLE_OPERATION_OUTPUT &&
+		table->quote == TABLE_QUOTE_KEEP &&
+		table_allcolsinorder(&header);
+	while (rows != TABLE_STREAM_NONE &&
+			(line = reader_getline(&reader, &length)) != NULL) {
+		if (length == 0) {
+			lineIndex++;
+			continue;
+		}
+		/* the cells are parts of the line, so a line without the
+		 * literal has no matching cell and is not even split
+		 */
+		if (prefilter && numTested == TABLE_LITERAL_SAMPLE &&
+				numFound > TABLE_LITERAL_SAMPLE /
+					TABLE_LITERAL_RATIO)
+			prefilter = false;
+		if (prefilter) {
+			numTested++;
+			if (scan_find(line, length, pattern.literal,
+						pattern.lenLiteral) == NULL) {
+				lineIndex++;
+				continue;
+			}
+			numFound++;
+		}
+		/* splitting changes the line, so it is kept before */
+		keepLine = keepLines && table_keepable(line, length);
+		if (keepLine) {
+			if (length + 1 > capKeptLine) {
+				char *newLine;
+
+				newLine = realloc(keptLine, length + 1);
+				if (newLine == NULL) {
+					fprintf(stderr, "error: %s\n",
+							strerror(errno));
+					goto end_out;
+				}
+				keptLine = newLine;
+				capKeptLine = length + 1;
+			}
+			memcpy(keptLine, line, length);
+			keptLine[length] = '\n';
+		}
+		if (table_splitline(&header, line, length, row) < 0) {
+			table_printparseerror(&header, lineIndex, line);
+			goto end_out;
+		}
+		lineIndex++;
+		if (rows == TABLE_STREAM_MATCHING) {
+			size_t i;
+
+			for (i = 0; i < numPatternCols; i++)
+				if (pattern_match(&pattern,
+							row[patternCols[i]]))
+					break;
+			if (i == numPatternCols)
+				continue;
+		}
+		if (output->operation == TABLE_OPERATION_PRINT) {
+			const Utf8 *const cell = row[header.activeCols[0]];
+			writer_write(&writer, cell, strlen(cell));
+			writer_putc(&writer, '\n');
+		} else if (keepLine) {
+			writer_write(&writer, keptLine, length + 1);
+		} else {
+			table_writerow(&writer, row, header.activeCols,
+					header.numActiveCols, table->quote);
+		}
+	}
+	if (reader.error != 0) {
+		fprintf(stderr, "unable to read '%s': %s\n",
+				commands[0].arg, strerror(reader.error));
+		goto end_out;
+	}
+	code = 0;
+
+end_out:
+	if (table_closeoutput(&writer, output->arg, temp) < 0)
+		code = -1;
+	free(keptLine);
+	if (compiled)
+		pattern_free(&pattern);
+end:
+	reader_close(&reader);
+	close(fd);
+	table_uninit(&header);
+	return code;
 }
@@ -0,0 +1,99 @@
+#include "tabular.h"
+
+static void table_freeresult(struct table_result *result)
+{
+	free(result->pattern);
+	free(result->colSet);
+	free(result->rowSet);
+	free(result->newRowSet);
+}
+
+void table_clearresults(Table *table)
+{
+	for (size_t i = 0; i < table->numResults; i++)
+		table_freeresult(&table->results[i]);
+	table->numResults = 0;
+}
+
+static bool table_sameset(const uint64_t *a, const uint64_t *b,
+		size_t numBits)
+{
+	/* the sets of an empty table might not be allocated */
+	return numBits == 0 ||
+		!memcmp(a, b, sizeof(*a) * TABLE_SET_WORDS(numBits));
+}
+
+bool table_recallrows(Table *table, bool filter, const Utf8 *pattern)
+{
+	struct table_result result;
+	size_t i;
+
+	for (i = 0; i < table->numResults; i++) {
+		const struct table_result *const r = &table->results[i];
+
+		/* the table changed since, none of the results hold */
+		if (r->version != table->version ||
+				r->numRows != table->numRows ||
+				r->numCols != table->numCols) {
+			table_clearresults(table);
+			return false;
+		}
+		if (r->filter == filter && !strcmp(r->pattern, pattern) &&
+				table_sameset(r->colSet, table->colSet,
+					table->numCols) &&
+				(!filter || table_sameset(r->rowSet,
+					table->rowSet, table->numRows)))
+			break;
+	}
+	if (i == table->numResults)
+		return false;
+
+	/* the most recently used result comes first */
+	result = table->results[i];
+	memmove(&table->results[1], &table->results[0],
+			sizeof(*table->results) * i);
+	table->results[0] = result;
+	for (i = 0; i < TABLE_SET_WORDS(table->numRows); i++)
+		table->newRowSet[i] = result.newRowSet[i];
+	return true;
+}
+
+static uint64_t *table_dupset(const uint64_t *set, size_t numBits)
+{
+	uint64_t *dup;
+
+	dup = malloc(sizeof(*set) * MAX(TABLE_SET_WORDS(numBits),
+				(size_t) 1));
+	for (size_t i = 0; dup != NULL && i < TABLE_SET_WORDS(numBits); i++)
+		dup[i] = set[i];
+	return dup;
+}
+
+void table_keeprows(Table *table, bool filter, const Utf8 *pattern)
+{
+	struct table_result result;
+
+	result.filter = filter;
+	result.pattern = strdup(pattern);
+	result.version = table->version;
+	result.numRows = table->numRows;
+	result.numCols = table->numCols;
+	result.colSet = table_dupset(table->colSet, table->numCols);
+	result.rowSet = filter ? table_dupset(table->rowSet, table->numRows) :
+		NULL;
+	result.newRowSet = table_dupset(table->newRowSet, table->numRows);
+	/* without memory the result is simply not kept */
+	if (result.pattern == NULL || result.colSet == NULL ||
+			(filter && result.rowSet == NULL) ||
+			result.newRowSet == NULL) {
+		table_freeresult(&result);
+		return;
+	}
+
+	if (table->numResults == ARRLEN(table->results))
+		table_freeresult(&table->results[--table->numResults]);
+	memmove(&table->results[1], &table->results[0],
+			sizeof(*table->results) * table->numResults);
+	table->results[0] = result;
+	table->numResults++;
+}
@@ -0,0 +1,379 @@
+#include "tabular.h"
+
+static const char *table_typenames[] = {
+	[TABLE_TYPE_UNKNOWN] = "unknown",
+	[TABLE_TYPE_STRING] = "string",
+	[TABLE_TYPE_INT] = "int64",
+	[TABLE_TYPE_DOUBLE] = "double",
+	[TABLE_TYPE_BOOL] = "bool",
+};
+
+const char *table_typename(enum table_type type)
+{
+	return table_typenames[type];
+}
+
+/* which types the cells seen so far fit into */
+struct table_typer {
+	bool isInt;
+	bool isDouble;
+	bool isBool;
+};
+
+static bool table_parseint(const char *cell, int64_t *pValue)
+{
+	char *end;
+	long long value;
+
+	if (!isdigit((unsigned char) cell[0]) &&
+			((cell[0] != '-' && cell[0] != '+') ||
+			 !isdigit((unsigned char) cell[1])))
+		return false;
+	errno = 0;
+	value = strtoll(cell, &end, 10);
+	if (*end != '\0' || errno == ERANGE)
+		return false;
+	*pValue = value;
+	return true;
+}
+
+/* Only plain decimal numbers, strtod() would also take "inf", "nan" and
+ * hexadecimal numbers. Must run with the "C" numeric locale.
+ */
+static bool table_parsedouble(const char *cell, double *pValue)
+{
+	char *end;
+
+	if (cell[strspn(cell, "0123456789+-.eE")] != '\0' ||
+			strpbrk(cell, "0123456789") == NULL)
+		return false;
+	*pValue = strtod(cell, &end);
+	return *end == '\0';
+}
+
+static bool table_parsebool(const char *cell, bool *pValue)
+{
+	if (!strcasecmp(cell, "true")) {
+		*pValue = true;
+		return true;
+	}
+	if (!strcasecmp(cell, "false")) {
+		*pValue = false;
+		return true;
+	}
+	return false;
+}
+
+static void table_typecell(struct table_typer *typer, const char *cell)
+{
+	int64_t i;
+	double d;
+	bool b;
+
+	if (*cell == '\0')
+		return;
+	if (typer->isInt && !table_parseint(cell, &i))
+		typer->isInt = false;
+	if (typer->isDouble && !typer->isInt &&
+			!table_parsedouble(cell, &d))
+		typer->isDouble = false;
+	if (typer->isBool && !table_parsebool(cell, &b))
+		typer->isBool = false;
+}
+
+static enum table_type table_choosetype(const struct table_typer *typer,
+		bool hasValues)
+{
+	if (!hasValues)
+		return TABLE_TYPE_STRING;
+	if (typer->isInt)
+		return TABLE_TYPE_INT;
+	if (typer->isDouble)
+		return TABLE_TYPE_DOUBLE;
+	if (typer->isBool)
+		return TABLE_TYPE_BOOL;
+	return TABLE_TYPE_STRING;
+}
+
+/* the sizes are never 0 so that empty tables get arrays as well */
+static size_t table_nullsize(size_t numRows)
+{
+	return sizeof(uint64_t) * (numRows / 64 + 1);
+}
+
+static size_t table_valuesize(enum table_type type, size_t numRows)
+{
+	switch (type) {
+	case TABLE_TYPE_INT:
+		return sizeof(int64_t) * (numRows + 1);
+	case TABLE_TYPE_DOUBLE:
+		return sizeof(double) * (numRows + 1);
+	case TABLE_TYPE_BOOL:
+		return table_nullsize(numRows);
+	default:
+		return 0;
+	}
+}
+
+void table_untype(Table *table, struct table_column *column)
+{
+	arena_free(&table->arena, column->values.ints,
+			table_valuesize(column->type, column->numTyped));
+	arena_free(&table->arena, column->nulls,
+			table_nullsize(column->numTyped));
+	column->type = TABLE_TYPE_UNKNOWN;
+	column->values.ints = NULL;
+	column->nulls = NULL;
+	column->numTyped = 0;
+}
+
+/* Gives a column whose type was just chosen room for its native values
+ * and its null bitmap, they are filled by table_setvalue().
+ */
+static int table_allocvalues(Table *table, struct table_column *column,
+		enum table_type type)
+{
+	const size_t numRows = table->numRows;
+	void *values = NULL;
+	uint64_t *nulls;
+
+	nulls = arena_alloc(&table->arena, table_nullsize(numRows));
+	if (nulls == NULL)
+		return -1;
+	memset(nulls, 0, table_nullsize(numRows));
+	if (type != TABLE_TYPE_STRING) {
+		values = arena_alloc(&table->arena,
+				table_valuesize(type, numRows));
+		if (values == NULL) {
+			arena_free(&table->arena, nulls,
+					table_nullsize(numRows));
+			return -1;
+		}
+		if (type == TABLE_TYPE_BOOL)
+			memset(values, 0, table_valuesize(type, numRows));
+	}
+	column->type = type;
+	column->values.ints = values;
+	column->nulls = nulls;
+	column->numTyped = numRows;
+	return 0;
+}
+
+static void table_setvalue(struct table_column *column, size_t row,
+		const char *cell)
+{
+	bool b = false;
+
+	if (*cell == '\0') {
+		column->nulls[row / 64] |= (uint64_t) 1 << (row % 64);
+		if (column->type == TABLE_TYPE_INT)
+			column->values.ints[row] = 0;
+		else if (column->type == TABLE_TYPE_DOUBLE)
+			column->values.doubles[row] = 0;
+		return;
+	}
+	switch (column->type) {
+	case TABLE_TYPE_INT:
+		table_parseint(cell, &column->values.ints[row]);
+		break;
+	case TABLE_TYPE_DOUBLE:
+		table_parsedouble(cell, &column->values.doubles[row]);
+		break;
+	case TABLE_TYPE_BOOL:
+		table_parsebool(cell, &b);
+		column->values.bools[row / 64] |= (uint64_t) b << (row % 64);
+		break;
+	default:
+		break;
+	}
+}
+
+/* Runs over the cells of the columns whose untyped entry is set, a lazy
+ * table is read row by row so that it parses every row only once.
+ */
+static void table_scantypes(Table *table, const size_t *cols, size_t numCols,
+		const bool *untyped, struct table_typer *typers,
+		bool *hasValues)
+{
+	if (table->lazy != NULL) {
+		for (size_t row = 0; row < table->numRows; row++)
+			for (size_t i = 0; i < numCols; i++) {
+				const char *cell;
+
+				if (!untyped[i])
+					continue;
+				cell = table_getcell(table, row, cols[i]);
+				if (typers == NULL) {
+					table_setvalue(&table->columns[cols[i]],
+							row, cell);
+					continue;
+				}
+				hasValues[i] |= *cell != '\0';
+				table_typecell(&typers[i], cell);
+			}
+		return;
+	}
+	for (size_t i = 0; i < numCols; i++) {
+		if (!untyped[i])
+			continue;
+		for (size_t row = 0; row < table->numRows; row++) {
+			const char *const cell =
+				table_getcell(table, row, cols[i]);
+			if (typers == NULL) {
+				table_setvalue(&table->columns[cols[i]],
+						row, cell);
+				continue;
+			}
+			hasValues[i] |= *cell != '\0';
+			table_typecell(&typers[i], cell);
+		}
+	}
+}
+
+int table_infertypes(Table *table, const size_t *cols, size_t numCols)
+{
+	struct table_typer *typers;
+	bool *hasValues, *untyped;
+	locale_t cLocale, oldLocale;
+	int code = 0;
+
+	typers = malloc(sizeof(*typers) * numCols);
+	hasValues = calloc(numCols, sizeof(*hasValues));
+	untyped = calloc(numCols, sizeof(*untyped));
+	cLocale = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+	if (typers == NULL || hasValues == NULL || untyped == NULL ||
+			cLocale == (locale_t) 0) {
+		snprintf(table->error, sizeof(table->error), "%s",
+				strerror(errno));
+		table->atText = NULL;
+		code = -1;
+		goto end;
+	}
+	oldLocale = uselocale(cLocale);
+	for (size_t i = 0; i < numCols; i++) {
+		struct table_column *const column = &table->columns[cols[i]];
+
+		/* rows were added or dropped without touching the column */
+		if (column->type != TABLE_TYPE_UNKNOWN &&
+				column->numTyped != table->numRows)
+			table_untype(table, column);
+		untyped[i] = column->type == TABLE_TYPE_UNKNOWN;
+		typers[i] = (struct table_typer) { true, true, true };
+	}
+
+	/* one pass to choose the types and one to convert the cells */
+	table_scantypes(table, cols, numCols, untyped, typers, hasValues);
+	for (size_t i = 0; i < numCols; i++) {
+		struct table_column *const column = &table->columns[cols[i]];
+
+		/* the same column might be listed twice */
+		if (!untyped[i] || column->type != TABLE_TYPE_UNKNOWN) {
+			untyped[i] = false;
+			continue;
+		}
+		if (table_allocvalues(table, column, table_choosetype(
+					&typers[i], hasValues[i])) < 0) {
+			snprintf(table->error, sizeof(table->error),
+					"%s", strerror(errno));
+			table->atText = NULL;
+			for (size_t j = 0; j < i; j++)
+				if (untyped[j])
+					table_untype(table,
+						&table->columns[cols[j]]);
+			code = -1;
+			break;
+		}
+	}
+	if (code == 0)
+		table_scantypes(table, cols, numCols, untyped, NULL, NULL);
+	uselocale(oldLocale);
+
+end:
+	if (cLocale != (locale_t) 0)
+		freelocale(cLocale);
+	free(untyped);
+	free(hasValues);
+	free(typers);
+	return code;
+}
+
+enum table_type table_gettype(Table *table, size_t col)
+{
+	if ((table->columns[col].type == TABLE_TYPE_UNKNOWN ||
+			table->columns[col].numTyped != table->numRows) &&
+			table_infertypes(table, &col, 1) < 0)
+		return TABLE_TYPE_UNKNOWN;
+	return table->columns[col].type;
+}
+
+/* Parses the number of a comparison in the "C" locale, like the cells */
+static bool table_parsenumber(const char *text, bool *pIsInt,
+		int64_t *pInt, double *pDouble)
+{
+	locale_t cLocale, oldLocale;
+	bool ok;
+
+	cLocale = newlocale(LC_NUMERIC_MASK, "C", (locale_t) 0);
+	if (cLocale == (locale_t) 0)
+		return false;
+	oldLocale = uselocale(cLocale);
+	*pIsInt = table_parseint(text, pInt);
+	ok = *pIsInt || table_parsedouble(text, pDouble);
+	uselocale(oldLocale);
+	freelocale(cLocale);
+	return ok;
+}
+
+int table_comparerows(Table *table, size_t col, const char *comparison,
+		const size_t *rows, size_t numRows, uint64_t *set)
+{
+	const struct table_column *column;
+	enum table_type type;
+	const bool less = comparison[0] == '<';
+	const bool orEqual = comparison[1] == '=';
+	const char *const number = &comparison[orEqual ? 2 : 1];
+	bool isInt;
+	int64_t intValue = 0;
+	double doubleValue = 0;
+
+	if (!table_parsenumber(number, &isInt, &intValue, &doubleValue)) {
+		snprintf(table->error, sizeof(table->error),
+				"'%s' is not a number", number);
+		table->atText = NULL;
+		return -1;
+	}
+	type = table_gettype(table, col);
+	if (type == TABLE_TYPE_UNKNOWN)
+		return -1;
+	if (type != TABLE_TYPE_INT && type != TABLE_TYPE_DOUBLE) {
+		snprintf(table->error, sizeof(table->error),
+				"column '%s' is %s, not a number",
+				table->colNames[col], table_typename(type));
+		table->atText = NULL;
+		return -1;
+	}
+	if (isInt)
+		doubleValue = intValue;
+
+	column = &table->columns[col];
+	for (size_t i = 0; i < numRows; i++) {
+		const size_t row = rows == NULL ? i : rows[i];
+		int order;
+
+		if (table_isnull(table, row, col))
+			continue;
+		/* whole numbers are compared exactly, the rest as doubles */
+		if (type == TABLE_TYPE_INT && isInt) {
+			const int64_t value = column->values.ints[row];
+			order = (value > intValue) - (value < intValue);
+		} else {
+			const double value = type == TABLE_TYPE_INT ?
+				(double) column->values.ints[row] :
+				column->values.doubles[row];
+			order = (value > doubleValue) - (value < doubleValue);
+		}
+		if (order == 0 ? orEqual : (order < 0) == less)
+			table_addtoset(set, row);
+	}
+	return 0;
+}
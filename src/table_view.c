@@ -18,19 +18,18 @@ static void table_view_showerror(TableView *view, const char *fmt, ...)
 	while (getchar() != '\n');
 }
 
-static void *table_view_realloc(TableView *view, void *ptr, size_t newSize,
-		const char *file, int line)
+static void *table_view_realloc(TableView *view, void *ptr, size_t oldSize,
+		size_t newSize, const char *file, int line)
 {
 	char choice;
-
-	(void) view;
+	void *newPtr;
 
 	if (newSize == 0)
 		return NULL;
 retry:
-	ptr = realloc(ptr, newSize);
-	if (ptr != NULL)
-		return ptr;
+	newPtr = arena_realloc(&view->table->arena, ptr, oldSize, newSize);
+	if (newPtr != NULL)
+		return newPtr;
 	endwin();
 	fprintf(stderr, ">>> failed allocating '%zu' bytes at %s:%d<<<\n",
 			newSize, file, line);
@@ -53,7 +52,11 @@ retry:
 	return NULL;
 }
 
-#define table_view_realloc(view, ptr, newSize) table_view_realloc(view, ptr, newSize, __FILE__, __LINE__);
+#define table_view_realloc(view, ptr, oldSize, newSize) \
+	table_view_realloc(view, ptr, oldSize, newSize, __FILE__, __LINE__);
+
+/* Rows of a lazy table that are looked at for the column widths */
+#define TABLE_VIEW_SAMPLE_ROWS ((size_t) 1000)
 
 static int table_view_updatecols(TableView *view)
 {
@@ -64,13 +67,18 @@ static int table_view_updatecols(TableView *view)
 	const size_t mostMaxWidth = cols / 4 + ((cols / 4) & 1);
 
 	Table *const table = view->table;
+	/* lazy tables would have to parse every row, a sample is enough */
+	const size_t numSampleRows = table->lazy == NULL ?
+		table->numActiveRows :
+		MIN(table->numActiveRows, TABLE_VIEW_SAMPLE_ROWS);
 
 	newColumnWidths = table_view_realloc(view, view->colWidths,
-			sizeof(*view->colWidths) *
-				table->numActiveCols);
+			sizeof(*view->colWidths) * view->numColWidths,
+			sizeof(*view->colWidths) * table->numActiveCols);
 	if (newColumnWidths == NULL)
 		return -1;
 	view->colWidths = newColumnWidths;
+	view->numColWidths = table->numActiveCols;
 
 	for (size_t i = 0; i < table->numActiveCols; i++) {
 		size_t maxWidth;
@@ -80,9 +88,9 @@ static int table_view_updatecols(TableView *view)
 		utf8_getfitting(name, mostMaxWidth, &fit);
 		maxWidth = fit.width;
 
-		for (size_t j = 0; j < table->numActiveRows; j++) {
+		for (size_t j = 0; j < numSampleRows; j++) {
 			const size_t row = table->activeRows[j];
-			const char *cell = table->cells[row][col];
+			const char *cell = table_getcell(table, row, col);
 			utf8_getfitting(cell, mostMaxWidth, &fit);
 			if (fit.width > maxWidth)
 				maxWidth = fit.width;
@@ -146,14 +154,17 @@ static void table_view_updatetext(TableView *view)
 			table->numActiveCols == 0) {
 		cell = "";
 	} else {
-		cell = table->cells[table->activeRows[view->cursor.row]]
-			[table->activeCols[view->cursor.col]];
+		cell = table_getcell(table,
+				table->activeRows[view->cursor.row],
+				table->activeCols[view->cursor.col]);
 	}
 	view->cursor.lenText = strlen(cell);
 	if (view->cursor.capText < view->cursor.lenText + 1) {
 		Utf8 *newText;
 
 		newText = table_view_realloc(view, view->cursor.text,
+				view->cursor.capText == 0 ? 0 :
+					view->cursor.capText + 1,
 				view->cursor.lenText + 1);
 		if (newText != NULL) {
 			view->cursor.text = newText;
@@ -223,8 +234,8 @@ static void table_view_render(TableView *view)
 		}
 
 		attr_on(A_REVERSE, NULL);
-		for (size_t i = 0; i < width; i++)
-			mvaddch(0, (int) (i + sx - view->scroll.x), ' ');
+		for (size_t k = 0; k < width; k++)
+			mvaddch(0, (int) (k + sx - view->scroll.x), ' ');
 		move(0, sx - view->scroll.x);
 		if (utf8_getfitting(title, width, &fit) != 0) {
 			move(0, sx - view->scroll.x);
@@ -238,7 +249,7 @@ static void table_view_render(TableView *view)
 				j < MIN(table->numActiveRows,
 					LINES - 2 + view->scroll.y); j++) {
 			const size_t row = table->activeRows[j];
-			const char *cell = table->cells[row][col];
+			const char *cell = table_getcell(table, row, col);
 			if (i == view->cursor.col && j == view->cursor.row) {
 				attr_on(A_REVERSE, NULL);
 			} else {
@@ -252,7 +263,7 @@ static void table_view_render(TableView *view)
 					"…");
 			} else {
 				addstr(cell);
-				for (size_t i = fit.width; i < width; i++)
+				for (size_t k = fit.width; k < width; k++)
 					addch(' ');
 			}
 		}
@@ -298,24 +309,17 @@ static void table_view_interruptcommand(TableView *view)
 
 static void table_view_updatecell(TableView *view, size_t row, size_t col)
 {
-	Utf8 **pOldCell;
-	Utf8 *newCell;
-
 	Table *const table = view->table;
 	if (table->numActiveRows == 0 || table->numActiveCols == 0)
 		return;
-	pOldCell = &table->cells[table->activeRows[row]]
-		[table->activeCols[col]];
-	newCell = table_view_realloc(view, *pOldCell, view->cursor.lenText + 1);
-	if (newCell != NULL) {
-		*pOldCell = newCell;
-		memcpy(newCell, view->cursor.text, view->cursor.lenText + 1);
-	}
+	if (table_setcell(table, table->activeRows[row],
+				table->activeCols[col], view->cursor.text) < 0)
+		table_view_showerror(view, "%s", table_strerror(table));
 }
 
 static void table_view_movecursor(TableView *view, int c)
 {
-	Utf8 *cell;
+	const Utf8 *cell;
 	size_t end;
 
 	Table *const table = view->table;
@@ -327,8 +331,9 @@ static void table_view_movecursor(TableView *view, int c)
 		if (view->cursor.row == 0)
 			break;
 		view->cursor.row--;
-		cell = table->cells[table->activeRows[view->cursor.row]]
-			[table->activeCols[view->cursor.col]];
+		cell = table_getcell(table,
+				table->activeRows[view->cursor.row],
+				table->activeCols[view->cursor.col]);
 		end = strlen(cell);
 		view->cursor.index = MIN(view->cursor.indexTracker, end);
 		view->cursor.scroll = 0;
@@ -338,8 +343,9 @@ static void table_view_movecursor(TableView *view, int c)
 		if (view->cursor.row + 1 >= table->numActiveRows)
 			break;
 		view->cursor.row++;
-		cell = table->cells[table->activeRows[view->cursor.row]]
-			[table->activeCols[view->cursor.col]];
+		cell = table_getcell(table,
+				table->activeRows[view->cursor.row],
+				table->activeCols[view->cursor.col]);
 		end = strlen(cell);
 		view->cursor.index = MIN(view->cursor.indexTracker, end);
 		view->cursor.scroll = 0;
@@ -454,6 +460,9 @@ table_view_executecommand(TableView *view, const char *cmd)
 		[TABLE_OPERATION_COL] = { "col", 1 },
 		[TABLE_OPERATION_SET_ROW] = { "set-row", 1 },
 		[TABLE_OPERATION_SET_COL] = { "set-col", 1 },
+		[TABLE_OPERATION_WHERE] = { "where", 1 },
+		[TABLE_OPERATION_AND_WHERE] = { "and-where", 1 },
+		[TABLE_OPERATION_OR_WHERE] = { "or-where", 1 },
 
 		[TABLE_OPERATION_APPEND] = { "append", 2 },
 		[TABLE_OPERATION_APPEND_COL] = { "append-col", 1 },
@@ -461,6 +470,13 @@ table_view_executecommand(TableView *view, const char *cmd)
 		[TABLE_OPERATION_UNDO] = { "undo", 0 },
 		[TABLE_OPERATION_REDO] = { "redo", 0 },
 
+		[TABLE_OPERATION_JOBS] = { "jobs", 1 },
+		[TABLE_OPERATION_CACHE] = { "cache", 0 },
+		[TABLE_OPERATION_LAZY] = { "lazy", 0 },
+		[TABLE_OPERATION_QUOTE] = { "quote", 1 },
+		[TABLE_OPERATION_HISTORY_MEM] = { "history-mem", 1 },
+		[TABLE_OPERATION_INDEX] = { "index", 0 },
+
 		{ "quit", 0 },
 	};
 	static const struct abbreviation {
@@ -486,6 +502,9 @@ table_view_executecommand(TableView *view, const char *cmd)
 		{ "col", "c" },
 		{ "set-row", "sr" },
 		{ "set-col", "sc" },
+		{ "where", "W" },
+		{ "and-where", "aw" },
+		{ "or-where", "ow" },
 
 		{ "append", "a" },
 		{ "append-col", "ac" },
@@ -493,6 +512,13 @@ table_view_executecommand(TableView *view, const char *cmd)
 		{ "undo", "U" },
 		{ "redo", "R" },
 
+		{ "jobs", "j" },
+		{ "cache", "C" },
+		{ "lazy", "L" },
+		{ "quote", "Q" },
+		{ "history-mem", "H" },
+		{ "index", "X" },
+
 		{ "quit", "q" },
 	};
 
@@ -572,11 +598,14 @@ static inline void table_view_inserttext(TableView *view, char *buf, int count)
 	if (view->cursor.capText < view->cursor.lenText + count + 1) {
 		Utf8 *newText;
 
-		view->cursor.capText += count;
-		newText = table_view_realloc(view, view->cursor.text, view->cursor.capText + 1);
+		newText = table_view_realloc(view, view->cursor.text,
+				view->cursor.capText == 0 ? 0 :
+					view->cursor.capText + 1,
+				view->cursor.capText + count + 1);
 		if (newText == NULL)
 			return;
 		view->cursor.text = newText;
+		view->cursor.capText += count;
 	}
 	memmove(&view->cursor.text[view->cursor.index + count],
 		&view->cursor.text[view->cursor.index],
@@ -691,14 +720,13 @@ static void table_view_hotkey(TableView *view, int c)
 	case 'd':
 		if (table->numActiveRows == 0)
 			break;
-		diff.rowDiff = malloc(sizeof(*diff.rowDiff));
-		if (diff.rowDiff == NULL)
+		memset(&diff, 0, sizeof(diff));
+		diff.rows.ranges = malloc(sizeof(*diff.rows.ranges));
+		if (diff.rows.ranges == NULL)
 			break;
-		diff.rowDiff[0].index = view->cursor.row;
-		diff.numChangedRows = 1;
-		diff.colDiff = 0;
-		diff.numChangedCols = 0;
-		table_validatediff(table, &diff);
+		diff.rows.ranges[0].first = table->activeRows[view->cursor.row];
+		diff.rows.ranges[0].count = 1;
+		diff.rows.numRanges = 1;
 		table_applydiff(table, &diff);
 		table_appendhistory(table, &diff);
 
@@ -710,14 +738,13 @@ static void table_view_hotkey(TableView *view, int c)
 		if (table->numActiveCols == 0)
 			break;
 
-		diff.rowDiff = NULL;
-		diff.numChangedRows = 0;
-		diff.colDiff = malloc(sizeof(*diff.colDiff));
-		if (diff.colDiff == NULL)
+		memset(&diff, 0, sizeof(diff));
+		diff.cols.ranges = malloc(sizeof(*diff.cols.ranges));
+		if (diff.cols.ranges == NULL)
 			break;
-		diff.colDiff[0].index = view->cursor.col;
-		diff.numChangedCols = 1;
-		table_validatediff(table, &diff);
+		diff.cols.ranges[0].first = table->activeCols[view->cursor.col];
+		diff.cols.ranges[0].count = 1;
+		diff.cols.numRanges = 1;
 		table_applydiff(table, &diff);
 		table_appendhistory(table, &diff);
 
@@ -740,6 +767,7 @@ static void table_view_hotkey(TableView *view, int c)
 	case 'A':
 		table_parseline(table, "");
 		view->cursor.col = 0;
+		table_addtoset(table->rowSet, table->numRows - 1);
 		table->activeRows[table->numActiveRows++] =
 			table->numRows - 1;
 		view->cursor.row = table->numActiveRows - 1;
@@ -768,7 +796,7 @@ static void table_view_hotkey(TableView *view, int c)
 	case ':':
 		view->mode = TABLE_VIEW_COMMAND;
 		if (view->cursor.capText == 0) {
-			view->cursor.text = malloc(1);
+			view->cursor.text = table_view_realloc(view, NULL, 0, 2);
 			if (view->cursor.text != NULL) {
 				view->cursor.capText = 1;
 				view->cursor.text[0] = '\0';
@@ -840,6 +868,8 @@ int table_view_show(TableView *view)
 void table_view_uninit(TableView *view)
 {
 	if (view->cursor.capText > 0)
-		free(view->cursor.text);
-	free(view->colWidths);
+		arena_free(&view->table->arena, view->cursor.text,
+				view->cursor.capText + 1);
+	arena_free(&view->table->arena, view->colWidths,
+			sizeof(*view->colWidths) * view->numColWidths);
 }
@@ -2,20 +2,31 @@
 #define TABULAR_H
 
 #define _XOPEN_SOURCE 700
+#define _DEFAULT_SOURCE
+/* for copy_file_range() */
+#define _GNU_SOURCE
 
 #include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
 #include <getopt.h>
 #include <inttypes.h>
 #include <limits.h>
 #include <locale.h>
 #include <ncurses.h>
+#include <pthread.h>
 #include <stdarg.h>
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
 #include <stdint.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
 #include <unistd.h>
 #include <wchar.h>
 
@@ -33,45 +44,442 @@
 })
 
 #include "utf8.h"
+#include "pattern.h"
+#include "arena.h"
+#include "scan.h"
+#include "parallel.h"
+#include "reader.h"
+#include "writer.h"
+
+/* what the cells of a column are, inferred by table_gettype() */
+enum table_type {
+	TABLE_TYPE_UNKNOWN,
+	TABLE_TYPE_STRING,
+	TABLE_TYPE_INT,
+	TABLE_TYPE_DOUBLE,
+	TABLE_TYPE_BOOL,
+};
 
 typedef struct table {
+	/* set when a function fails, see table_strerror() */
+	char error[128];
 	const Utf8 *atText;
+	/* number of threads used for loading and writing */
+	size_t numJobs;
+	/* load and save snapshots next to the input files, see --cache */
+	bool useCache;
+	/* only index the lines of the input files, see --lazy */
+	bool useLazy;
+	/* index the trigrams of the cells after loading, see --index */
+	bool useIndex;
+	/* how the cells are quoted when written, see --quote */
+	enum table_quote {
+		TABLE_QUOTE_ALL,
+		TABLE_QUOTE_MINIMAL,
+		/* minimal, but rows that were not changed are copied
+		 * from their file as they are
+		 */
+		TABLE_QUOTE_KEEP,
+	} quote;
+	/* owns the column names, columns and selection arrays */
+	Arena arena;
 	Utf8 **colNames;
-	Utf8 ***cells;
+	/* the cells are stored column by column, see table_getcell() */
+	struct table_column {
+		/* Start of the cell texts. The texts are owned by the column
+		 * when capText is not 0, otherwise they are borrowed from
+		 * a mapping.
+		 */
+		char *text;
+		size_t lenText;
+		size_t capText;
+		/* bytes of the owned text that no cell refers to anymore,
+		 * fewer when cells decoded from a dictionary shared them
+		 */
+		size_t deadText;
+		/* offset of each cell in text, TABLE_EMPTY_CELL for empty
+		 * cells, all cells at or behind numOffsets are empty. Short
+		 * cells can be in the offset itself, see TABLE_INLINE_MAX.
+		 * The offsets are borrowed from a snapshot when capOffsets
+		 * is 0.
+		 */
+		size_t *offsets;
+		size_t numOffsets;
+		size_t capOffsets;
+		/* Set instead of offsets for dictionary encoded columns,
+		 * codeSize bytes per cell index dict, the offsets of the
+		 * distinct cells in text. See table_encodecolumns().
+		 */
+		void *codes;
+		size_t codeSize;
+		size_t *dict;
+		size_t numDict;
+		/* Native values of the first numTyped cells, int64_t or
+		 * double per cell or one bit per cell for booleans. Bits
+		 * of nulls are set for empty cells. Dropped on any change.
+		 */
+		enum table_type type;
+		union {
+			int64_t *ints;
+			double *doubles;
+			uint64_t *bools;
+		} values;
+		uint64_t *nulls;
+		size_t numTyped;
+		/* The rows of each distinct cell, built by the second exact
+		 * search of the column and dropped when a cell changes. The
+		 * first search only sets searched and scans the cells, so a
+		 * one-off lookup does not pay for hashing the whole column.
+		 */
+		struct table_hash *hash;
+		bool searched;
+	} *columns;
 	size_t numRows;
 	size_t numCols;
+	/* allocated rows of activeRows, rowSet and newRowSet */
+	size_t capRows;
+	/* allocated cols of colNames, columns, activeCols, colSet and
+	 * newColSet
+	 */
+	size_t capCols;
+
+	/* Files loaded through table_parsemappedline(), columns borrow
+	 * their cells from the last one of these as long as they are not
+	 * changed.
+	 */
+	struct table_mapping {
+		char *data;
+		size_t size;
+		/* the file itself, only kept with TABLE_QUOTE_KEEP,
+		 * otherwise -1
+		 */
+		int fd;
+		/* the rows from numRows at the time of mapping on are
+		 * in this file
+		 */
+		size_t firstRow;
+		/* which file it is, so that it is not written over */
+		dev_t dev;
+		ino_t ino;
+	} *mappings;
+	size_t numMappings;
+	char *mappedText;
+	/* Where each of the first numLines rows is in the file of its
+	 * mapping, start is TABLE_NO_LINE for rows that are not in one as
+	 * they are. Only kept with TABLE_QUOTE_KEEP.
+	 */
+	struct table_line {
+		size_t start;
+		size_t length;
+	} *lines;
+	size_t numLines;
+	size_t capLines;
+	/* set while the rows are only parsed when their cells are read */
+	struct table_lazy *lazy;
+	/* built in the background, see table_startindex() */
+	struct table_index *index;
+	/* scratch space of table_parse_row() */
+	struct table_slice {
+		char *start;
+		size_t length;
+	} *slices;
+	size_t capSlices;
 
+	/* The selection, bit i of a set is word i / 64 and stands for row
+	 * or column i, bits behind numRows and numCols are always clear.
+	 * activeRows and activeCols list the same in ascending order and
+	 * are rebuilt by table_listactive().
+	 */
+	uint64_t *rowSet;
+	uint64_t *colSet;
 	size_t *activeRows;
 	size_t numActiveRows;
 	size_t *activeCols;
 	size_t numActiveCols;
 
-	size_t *newActiveRows;
-	size_t newNumActiveRows;
-	size_t *newActiveCols;
-	size_t newNumActiveCols;
+	/* what the running operation selects */
+	uint64_t *newRowSet;
+	uint64_t *newColSet;
+
+	/* bumped by every change to the table */
+	size_t version;
+	/* The rows the last searches selected, the most recently used
+	 * first. The rows a filter started from are in rowSet, it is NULL
+	 * for searches of all rows. See table_recallrows().
+	 */
+	struct table_result {
+		bool filter;
+		char *pattern;
+		size_t version;
+		size_t numRows;
+		size_t numCols;
+		uint64_t *colSet;
+		uint64_t *rowSet;
+		uint64_t *newRowSet;
+	} results[8];
+	size_t numResults;
 
+	/* Each change toggles the rows and the columns of its two parts.
+	 * A part is either a list of ranges or, when that would take more
+	 * memory, the changed bits of the words from firstWord on.
+	 */
 	struct table_diff {
-		struct table_diff_row {
-			size_t index;
-			size_t row;
-		} *rowDiff;
-		size_t numChangedRows;
-		struct table_diff_column {
-			size_t index;
-			size_t col;
-		} *colDiff;
-		size_t numChangedCols;
+		struct table_diff_part {
+			struct table_diff_range {
+				size_t first;
+				size_t count;
+			} *ranges;
+			size_t numRanges;
+			uint64_t *words;
+			size_t firstWord;
+			size_t numWords;
+		} rows, cols;
+		/* where the parts are in spillFile once they are spilled */
+		off_t spillAt;
 	} *history;
 	size_t indexHistory;
 	size_t numHistory;
+	/* bytes of the diffs in memory and how many they may take before
+	 * the oldest are moved into spillFile, see --history-mem
+	 */
+	size_t historyBytes;
+	size_t historyMem;
+	/* the first numSpilled diffs of history are only in this file */
+	FILE *spillFile;
+	size_t numSpilled;
+	off_t spillEnd;
 } Table;
 
+/* Default of --history-mem */
+#define TABLE_HISTORY_MEM ((size_t) 64 << 20)
+
+/* the text of a column is compacted once this much of it and at least
+ * half of it is dead, see table_setcell()
+ */
+#define TABLE_COMPACT_MIN ((size_t) 64 << 10)
+#define TABLE_EMPTY_CELL SIZE_MAX
+#define TABLE_NO_LINE SIZE_MAX
+/* Cells of at most TABLE_INLINE_MAX bytes that are copied into a column
+ * are stored null terminated in their offset instead of in the text.
+ * The most significant byte of such an offset is TABLE_INLINE_TAG,
+ * which no offset into a text ever reaches.
+ */
+#define TABLE_INLINE_MAX (sizeof(size_t) - 2)
+#define TABLE_INLINE_TAG 0xff
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define TABLE_INLINE_TAG_BYTE 0
+#define TABLE_INLINE_START 1
+#else
+#define TABLE_INLINE_TAG_BYTE (sizeof(size_t) - 1)
+#define TABLE_INLINE_START 0
+#endif
+
+static inline size_t table_inlineoffset(const char *text, size_t length)
+{
+	size_t offset = 0;
+	unsigned char *const bytes = (unsigned char*) &offset;
+
+	memcpy(&bytes[TABLE_INLINE_START], text, length);
+	bytes[TABLE_INLINE_TAG_BYTE] = TABLE_INLINE_TAG;
+	return offset;
+}
+
+static inline bool table_isinline(size_t offset)
+{
+	return offset != TABLE_EMPTY_CELL && ((const unsigned char*)
+			&offset)[TABLE_INLINE_TAG_BYTE] == TABLE_INLINE_TAG;
+}
+
+/* The cell that the offset at *pOffset stands for, inline cells point
+ * into the offset itself.
+ */
+static inline const Utf8 *table_offsetcell(const char *text,
+		const size_t *pOffset)
+{
+	if (*pOffset == TABLE_EMPTY_CELL)
+		return "";
+	if (table_isinline(*pOffset))
+		return (const Utf8*) pOffset + TABLE_INLINE_START;
+	return &text[*pOffset];
+}
+
 int table_init(Table *table);
+/* Initializes an empty table with the columns of header, its rows can
+ * be moved over with table_takerows().
+ */
+int table_initlike(Table *table, Table *header);
 const char *table_strerror(Table *table);
 int table_parseline(Table *table, const char *line);
+/* Hands a region mapped with mmap() over to the table, the table
+ * unmaps it when it is uninitialized. st is the status of the mapped
+ * file.
+ */
+int table_addmapping(Table *table, char *data, size_t size,
+		const struct stat *st);
+/* Parses a line in place, the line must be part of the last
+ * mapping added with table_addmapping() and be null terminated at
+ * line[length].
+ */
+int table_parsemappedline(Table *table, char *line, size_t length);
+/* Whether the line only has the separators that are written, so that it
+ * can be copied next to formatted rows.
+ */
+bool table_keepable(const char *line, size_t length);
+/* Remembers that the row is the line at start in mappedText. */
+int table_keepline(Table *table, size_t row, size_t start, size_t length);
+/* Splits a line in place like table_parsemappedline() but does not
+ * add it to the table. The row must have room for table->numCols cells,
+ * short rows are padded with empty cells.
+ */
+int table_splitline(Table *table, char *line, size_t length, Utf8 **row);
+/* Moves all rows of from into table, from must have been created
+ * with table_initlike() and is uninitialized afterwards.
+ */
+int table_takerows(Table *table, Table *from);
+/* An index of the trigrams of each column, the rows that a pattern
+ * might match are then found without reading every cell. It is built by
+ * a thread that only reads the table, so every change to the table
+ * waits for it first with table_waitindex(). Cells changed afterwards
+ * are reported with table_touchindex(), rows and columns added
+ * afterwards are not indexed.
+ */
+void table_startindex(Table *table);
+void table_waitindex(Table *table);
+void table_freeindex(Table *table);
+void table_touchindex(Table *table, size_t row);
+/* Lists the rows among rows, NULL for all rows, that might have a cell
+ * in one of the columns cols matching the pattern. Returns 1 when the
+ * index can not tell, -1 when there is no memory.
+ */
+int table_indexcandidates(Table *table, const Pattern *pattern,
+		const size_t *cols, size_t numCols,
+		const size_t *rows, size_t numRows,
+		size_t **pCandidates, size_t *pNumCandidates);
+/* Puts the rows into newRowSet that were selected by the same search of
+ * the same columns and, for a filter, the same rows if the table did
+ * not change since. Returns whether there was such a search.
+ */
+bool table_recallrows(Table *table, bool filter, const Utf8 *pattern);
+/* Remembers newRowSet as the result of the search, the least recently
+ * used result is dropped when there are too many.
+ */
+void table_keeprows(Table *table, bool filter, const Utf8 *pattern);
+void table_clearresults(Table *table);
+/* Frees the hash of the column, see table_hashrows(). */
+void table_freehash(struct table_column *column);
+/* Adds the rows among rows, NULL for all rows, with a cell in one of
+ * the columns cols equal to an alternative of the pattern to set. The
+ * hashes of the columns are built or extended first. Returns 1 when the
+ * pattern is not exact or a column is searched for the first time, -1
+ * when there is no memory.
+ */
+int table_hashrows(Table *table, const Pattern *pattern,
+		const size_t *cols, size_t numCols,
+		const size_t *rows, size_t numRows, uint64_t *set);
+/* Cells of a lazy table are only valid until the next call. */
+const Utf8 *table_getlazycell(Table *table, size_t row, size_t col);
+/* Dictionary code of a cell of an encoded column. */
+static inline size_t table_getcode(const struct table_column *column,
+		size_t row)
+{
+	switch (column->codeSize) {
+	case 1:
+		return ((const uint8_t*) column->codes)[row];
+	case 2:
+		return ((const uint16_t*) column->codes)[row];
+	default:
+		return ((const uint32_t*) column->codes)[row];
+	}
+}
+static inline const Utf8 *table_getcell(Table *table, size_t row,
+		size_t col)
+{
+	const struct table_column *const column = &table->columns[col];
+	size_t offset;
+
+	if (table->lazy != NULL)
+		return table_getlazycell(table, row, col);
+	if (row >= column->numOffsets)
+		return "";
+	if (column->codes == NULL)
+		return table_offsetcell(column->text, &column->offsets[row]);
+	offset = column->dict[table_getcode(column, row)];
+	if (offset == TABLE_EMPTY_CELL)
+		return "";
+	return &column->text[offset];
+}
+int table_setcell(Table *table, size_t row, size_t col, const Utf8 *text);
+/* Stores each column that has few distinct cells as codes into a
+ * dictionary of them, lazy tables are left as they are.
+ */
+int table_encodecolumns(Table *table);
+/* Turns the codes of an encoded column back into offsets, any change
+ * to a column needs this first.
+ */
+int table_decodecolumn(Table *table, struct table_column *column);
+/* Infers the type of a column from its cells on first use and fills
+ * its native values. Returns TABLE_TYPE_UNKNOWN on failure.
+ */
+enum table_type table_gettype(Table *table, size_t col);
+int table_infertypes(Table *table, const size_t *cols, size_t numCols);
+const char *table_typename(enum table_type type);
+void table_untype(Table *table, struct table_column *column);
+static inline bool table_isnull(const Table *table, size_t row, size_t col)
+{
+	const struct table_column *const column = &table->columns[col];
+	return (column->nulls[row / 64] >> (row % 64)) & 1;
+}
+/* Adds the rows whose number in the column compares true with the
+ * comparison, "<N", "<=N", ">N" or ">=N", to the set. Empty cells never
+ * do. Runs over the native values, which the column must be able to
+ * have: int64 or double.
+ */
+int table_comparerows(Table *table, size_t col, const char *comparison,
+		const size_t *rows, size_t numRows, uint64_t *set);
+/* Words of a selection set of this many rows or columns */
+#define TABLE_SET_WORDS(n) (((n) + 63) / 64)
+static inline bool table_inset(const uint64_t *set, size_t i)
+{
+	return (set[i / 64] >> (i % 64)) & 1;
+}
+static inline void table_addtoset(uint64_t *set, size_t i)
+{
+	set[i / 64] |= (uint64_t) 1 << (i % 64);
+}
+/* Grow the allocated rows or cols of the table, used by code that
+ * fills in the columns directly.
+ */
+int table_reserverows(Table *table, size_t numRows);
+int table_reservecols(Table *table, size_t numCols);
+int table_appendcol(Table *table, const Utf8 *name);
 void table_uninit(Table *table);
 
+/* Snapshots of a loaded file that are kept next to it, see --cache.
+ * table_loadcache() returns 1 if there is no snapshot matching the
+ * size and modification time of the file, the table is unchanged then.
+ */
+int table_loadcache(Table *table, const char *path, const struct stat *st);
+int table_savecache(Table *table, const char *path, const struct stat *st);
+
+/* Makes the rows in [begin, end) of the last mapping lazy, only the
+ * start of each line is stored and a line is parsed when one of its
+ * cells is read. The table must not have any rows yet. firstLine is the
+ * index of the line at begin in its file, for reporting bad lines.
+ */
+int table_setlazy(Table *table, char *begin, char *end, size_t firstLine);
+/* Parses all rows of a lazy table, this happens before the first
+ * change. On failure, the rows before the bad line are kept.
+ */
+int table_materialize(Table *table);
+/* Splits every row of a lazy table that was not split before, so that
+ * a bad line is found before the whole table is used. The rows from it
+ * on are dropped like the eager loader does, *pLineIndex is then the
+ * index of the line in its file and *pLine a copy of it that is valid
+ * until the next call, *pLine is NULL when there was no memory.
+ */
+int table_checklazy(Table *table, size_t *pLineIndex, const char **pLine);
+void table_uninitlazy(Table *table);
+
 enum table_operation {
 	TABLE_OPERATION_INFO,
 	TABLE_OPERATION_VIEW,
@@ -93,15 +501,40 @@ enum table_operation {
 	TABLE_OPERATION_COL,
 	TABLE_OPERATION_SET_ROW,
 	TABLE_OPERATION_SET_COL,
+	TABLE_OPERATION_WHERE,
+	TABLE_OPERATION_AND_WHERE,
+	TABLE_OPERATION_OR_WHERE,
 
 	TABLE_OPERATION_APPEND,
 	TABLE_OPERATION_APPEND_COL,
 
 	TABLE_OPERATION_UNDO,
 	TABLE_OPERATION_REDO,
+
+	TABLE_OPERATION_JOBS,
+	TABLE_OPERATION_CACHE,
+	TABLE_OPERATION_LAZY,
+	TABLE_OPERATION_QUOTE,
+	TABLE_OPERATION_HISTORY_MEM,
+	TABLE_OPERATION_INDEX,
 };
 
 void table_dooperation(Table *table, enum table_operation operation, const void *arg);
+
+struct table_command {
+	enum table_operation operation;
+	const char *arg;
+};
+
+/* Runs a command line of the form
+ *   --input <file> [selections...] --output/--print
+ * in a single pass over the input without loading the table, so that
+ * memory is bounded by the longest line. Only selections that can be
+ * decided one row at a time are allowed. Returns 1 if the commands can
+ * not be streamed, nothing was done in that case.
+ */
+int table_stream(Table *table, const struct table_command *commands,
+		size_t numCommands);
 /* If functions outside of table_operations.c want to make
  * undoable changes to the table, they need to use
  * on of these functions.
@@ -110,10 +543,17 @@ void table_dooperation(Table *table, enum table_operation operation, const void
  * will make you lose ownership of the memory, all memory is
  * handled by Table from that moment on.
  */
-void table_validatediff(Table *table, struct table_diff *diff);
 int table_generatediff(Table *table);
 int table_appendhistory(Table *table, const struct table_diff *diff);
 void table_applydiff(Table *table, const struct table_diff *diff);
+void table_freediff(struct table_diff *diff);
+/* Gives the diff at index of the history, returns 1 when it was read
+ * back from the spill file and has to be freed with table_freediff().
+ */
+int table_loaddiff(Table *table, size_t index, struct table_diff *diff);
+void table_clearhistory(Table *table);
+/* Rebuilds activeRows and activeCols from rowSet and colSet. */
+void table_listactive(Table *table);
 
 enum table_view_mode {
 	TABLE_VIEW_NORMAL,
@@ -125,6 +565,7 @@ typedef struct table_view {
 	Table *table;
 	enum table_view_mode mode;
 	size_t *colWidths;
+	size_t numColWidths;
 	struct {
 		size_t row;
 		size_t col;
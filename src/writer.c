@@ -0,0 +1,167 @@
+#include "tabular.h"
+
+/* Writes all of the vectors, even if write() takes only a part. */
+static void writer_writev(Writer *writer, struct iovec *vectors,
+		int numVectors)
+{
+	while (numVectors > 0 && writer->error == 0) {
+		ssize_t count;
+
+		count = writev(writer->fd, vectors, numVectors);
+		if (count < 0) {
+			if (errno != EINTR)
+				writer->error = errno;
+			continue;
+		}
+		while (numVectors > 0 && (size_t) count >= vectors->iov_len) {
+			count -= vectors->iov_len;
+			vectors++;
+			numVectors--;
+		}
+		if (numVectors > 0) {
+			vectors->iov_base = (char*) vectors->iov_base + count;
+			vectors->iov_len -= count;
+		}
+	}
+}
+
+int writer_open(Writer *writer, int fd)
+{
+	const long pageSize = sysconf(_SC_PAGESIZE);
+	void *buffer;
+
+	memset(writer, 0, sizeof(*writer));
+	writer->fd = fd;
+	errno = posix_memalign(&buffer, pageSize > 0 ? pageSize : 4096,
+			WRITER_BUFFER_SIZE);
+	if (errno != 0)
+		return -1;
+	writer->buffer = buffer;
+	writer->capBuffer = WRITER_BUFFER_SIZE;
+	return 0;
+}
+
+int writer_openmemory(Writer *writer)
+{
+	memset(writer, 0, sizeof(*writer));
+	writer->fd = -1;
+	writer->capBuffer = WRITER_MEMORY_SIZE;
+	writer->buffer = malloc(writer->capBuffer);
+	return writer->buffer == NULL ? -1 : 0;
+}
+
+/* Makes room for length more bytes in a memory writer. */
+static bool writer_grow(Writer *writer, size_t length)
+{
+	char *newBuffer;
+	size_t newCap;
+
+	if (writer->error != 0)
+		return false;
+	newCap = MAX(writer->capBuffer * 2, writer->length + length);
+	newBuffer = realloc(writer->buffer, newCap);
+	if (newBuffer == NULL) {
+		writer->error = errno;
+		return false;
+	}
+	writer->buffer = newBuffer;
+	writer->capBuffer = newCap;
+	return true;
+}
+
+void writer_write(Writer *writer, const char *data, size_t length)
+{
+	struct iovec vectors[2];
+
+	if (length <= writer->capBuffer - writer->length) {
+		memcpy(&writer->buffer[writer->length], data, length);
+		writer->length += length;
+		return;
+	}
+	if (writer->fd < 0) {
+		if (writer_grow(writer, length)) {
+			memcpy(&writer->buffer[writer->length], data, length);
+			writer->length += length;
+		}
+		return;
+	}
+	if (length < WRITER_BUFFER_SIZE) {
+		writer_flush(writer);
+		memcpy(writer->buffer, data, length);
+		writer->length = length;
+		return;
+	}
+	vectors[0].iov_base = writer->buffer;
+	vectors[0].iov_len = writer->length;
+	vectors[1].iov_base = (char*) data;
+	vectors[1].iov_len = length;
+	writer_writev(writer, vectors, 2);
+	writer->length = 0;
+}
+
+void writer_flush(Writer *writer)
+{
+	struct iovec vector;
+
+	if (writer->fd < 0) {
+		writer_grow(writer, 1);
+		return;
+	}
+	vector.iov_base = writer->buffer;
+	vector.iov_len = writer->length;
+	writer_writev(writer, &vector, 1);
+	writer->length = 0;
+}
+
+void writer_copyfile(Writer *writer, int fd, off_t offset, size_t length)
+{
+	bool useCopy = true, useSend = true;
+
+	writer_flush(writer);
+	while (length > 0 && writer->error == 0) {
+		ssize_t count = -1;
+
+		/* copy_file_range() needs two regular files and sendfile()
+		 * a file that can be mapped, whatever fails is not tried
+		 * again
+		 */
+		if (useCopy) {
+			count = copy_file_range(fd, &offset, writer->fd, NULL,
+					length, 0);
+			if (count == 0 || (count < 0 && errno != EINTR))
+				useCopy = false;
+		} else if (useSend) {
+			count = sendfile(writer->fd, fd, &offset, length);
+			if (count == 0 || (count < 0 && errno != EINTR))
+				useSend = false;
+		} else {
+			count = pread(fd, writer->buffer,
+					MIN(length, writer->capBuffer), offset);
+			if (count == 0)
+				errno = EIO;
+			if (count <= 0) {
+				if (errno != EINTR)
+					writer->error = errno;
+				continue;
+			}
+			offset += count;
+			writer->length = count;
+			writer_flush(writer);
+		}
+		if (count > 0)
+			length -= count;
+	}
+}
+
+int writer_close(Writer *writer)
+{
+	if (writer->fd >= 0)
+		writer_flush(writer);
+	free(writer->buffer);
+	writer->buffer = NULL;
+	if (writer->error != 0) {
+		errno = writer->error;
+		return -1;
+	}
+	return 0;
+}
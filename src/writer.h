@@ -0,0 +1,43 @@
+/* Writes to a file descriptor through one large buffer.
+ *
+ * Small pieces are copied into the buffer, which is written with a
+ * single write() when it is full. A piece that does not fit is written
+ * together with the buffer by writev() instead of being copied. The
+ * first error sticks, everything after it is dropped.
+ *
+ * A writer opened with writer_openmemory() has no file descriptor, its
+ * buffer grows instead and holds everything written to it.
+ */
+#define WRITER_BUFFER_SIZE ((size_t) 1 << 20)
+/* initial size of a memory writer */
+#define WRITER_MEMORY_SIZE ((size_t) 1 << 16)
+
+typedef struct writer {
+	int fd;
+	char *buffer;
+	size_t length;
+	size_t capBuffer;
+	int error;
+} Writer;
+
+int writer_open(Writer *writer, int fd);
+int writer_openmemory(Writer *writer);
+void writer_write(Writer *writer, const char *data, size_t length);
+void writer_flush(Writer *writer);
+/* Writes length bytes of the file fd from offset on, in the kernel
+ * when it can do it. Not for memory writers.
+ */
+void writer_copyfile(Writer *writer, int fd, off_t offset, size_t length);
+static inline void writer_putc(Writer *writer, char c)
+{
+	if (writer->length == writer->capBuffer) {
+		writer_flush(writer);
+		if (writer->length == writer->capBuffer)
+			return;
+	}
+	writer->buffer[writer->length++] = c;
+}
+/* Flushes the buffer and returns -1 with errno set if anything could
+ * not be written. Does not close the file descriptor.
+ */
+int writer_close(Writer *writer);
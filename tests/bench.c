@@ -0,0 +1,268 @@
+#include "../src/tabular.h"
+
+#include <math.h>
+#include <time.h>
+
+/* Throughput of the structural scanner and of the writer next to the
+ * byte by byte code they replaced. Both must give the same results as
+ * the old code, the speeds are only printed. ./build.sh does not
+ * optimize, for real numbers build it with -O2:
+ *   gcc -O2 -Isrc src/[!m]*.c tests/bench.c -lncursesw -lpthread
+ */
+
+#define NUM_LINES 200000
+#define NUM_CELLS 10
+#define NUM_RUNS 3
+
+static char *text;
+static size_t lenText;
+static size_t *lines;
+
+static void make_lines(void)
+{
+	unsigned seed = 1;
+	char *s;
+
+	text = malloc((size_t) NUM_LINES * NUM_CELLS * 48);
+	lines = malloc(sizeof(*lines) * (NUM_LINES + 1));
+	s = text;
+	for (size_t i = 0; i < NUM_LINES; i++) {
+		lines[i] = s - text;
+		for (int j = 0; j < NUM_CELLS; j++) {
+			const int length = rand_r(&seed) % 40 + 1;
+			const bool quoted = rand_r(&seed) % 4 == 0;
+
+			if (j > 0)
+				*s++ = ';';
+			if (quoted)
+				*s++ = '\"';
+			for (int k = 0; k < length; k++)
+				*s++ = quoted && k % 13 == 7 ? ',' :
+					'a' + rand_r(&seed) % 26;
+			if (quoted)
+				*s++ = '\"';
+		}
+		*s++ = '\0';
+	}
+	lines[NUM_LINES] = s - text;
+	lenText = s - text;
+}
+
+static double now(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void report(const char *name, double seconds, size_t bytes)
+{
+	printf("%-24s %8.3f s %8.0f MB/s\n", name, seconds,
+			bytes / seconds / 1e6);
+}
+
+/* The separator and quote positions of all lines added up, the way the
+ * parser asks for them.
+ */
+static size_t scan_scanner(void)
+{
+	size_t sum = 0;
+
+	for (size_t i = 0; i < NUM_LINES; i++) {
+		const char *const line = &text[lines[i]];
+		const size_t length = lines[i + 1] - lines[i] - 1;
+		Scanner scanner;
+
+		scan_init(&scanner, line, length);
+		for (size_t pos = 0; pos < length; pos++) {
+			pos = scan_next(&scanner, pos, SCAN_SEPARATOR);
+			sum += pos;
+		}
+		for (size_t pos = 0; pos < length; pos++) {
+			pos = scan_next(&scanner, pos, SCAN_QUOTE);
+			sum += pos;
+		}
+	}
+	return sum;
+}
+
+static size_t scan_strcspn(void)
+{
+	size_t sum = 0;
+
+	for (size_t i = 0; i < NUM_LINES; i++) {
+		const char *const line = &text[lines[i]];
+		const size_t length = lines[i + 1] - lines[i] - 1;
+
+		for (size_t pos = 0; pos < length; pos++) {
+			pos += strcspn(&line[pos], "\t,;");
+			sum += pos;
+		}
+		for (size_t pos = 0; pos < length; pos++) {
+			pos += strcspn(&line[pos], "\"");
+			sum += pos;
+		}
+	}
+	return sum;
+}
+
+static size_t scan_bytes(void)
+{
+	size_t sum = 0;
+
+	for (size_t i = 0; i < NUM_LINES; i++) {
+		const char *const line = &text[lines[i]];
+		const size_t length = lines[i + 1] - lines[i] - 1;
+
+		for (size_t pos = 0; pos < length; pos++) {
+			while (line[pos] != '\0' && line[pos] != '\t' &&
+					line[pos] != ',' && line[pos] != ';')
+				pos++;
+			sum += pos;
+		}
+		for (size_t pos = 0; pos < length; pos++) {
+			while (line[pos] != '\0' && line[pos] != '\"')
+				pos++;
+			sum += pos;
+		}
+	}
+	return sum;
+}
+
+static bool bench_scan(void)
+{
+	static const struct {
+		const char *name;
+		size_t (*scan)(void);
+	} scans[] = {
+		{ "scan: byte loop", scan_bytes },
+		{ "scan: strcspn", scan_strcspn },
+		{ "scan: scanner", scan_scanner },
+	};
+	size_t expected = 0;
+	bool ok = true;
+
+	for (size_t i = 0; i < ARRLEN(scans); i++) {
+		double best = HUGE_VAL;
+		size_t sum = 0;
+
+		for (int run = 0; run < NUM_RUNS; run++) {
+			const double start = now();
+			sum = scans[i].scan();
+			best = MIN(best, now() - start);
+		}
+		report(scans[i].name, best, lenText);
+		if (i == 0)
+			expected = sum;
+		else if (sum != expected)
+			ok = false;
+	}
+	return ok;
+}
+
+/* every cell quoted, like table_writeout() before and after the writer */
+static void write_stdio(FILE *fp)
+{
+	for (size_t i = 0; i < NUM_LINES; i++) {
+		const char *cell = &text[lines[i]];
+
+		for (int j = 0; j < NUM_CELLS; j++) {
+			const size_t length = strcspn(cell, ";");
+
+			if (j > 0)
+				fputc(';', fp);
+			fprintf(fp, "\"%.*s\"", (int) length, cell);
+			cell += length + 1;
+		}
+		fputc('\n', fp);
+	}
+}
+
+static void write_writer(Writer *writer)
+{
+	for (size_t i = 0; i < NUM_LINES; i++) {
+		const char *cell = &text[lines[i]];
+
+		for (int j = 0; j < NUM_CELLS; j++) {
+			const size_t length = strcspn(cell, ";");
+
+			if (j > 0)
+				writer_putc(writer, ';');
+			writer_putc(writer, '\"');
+			writer_write(writer, cell, length);
+			writer_putc(writer, '\"');
+			cell += length + 1;
+		}
+		writer_putc(writer, '\n');
+	}
+}
+
+static bool bench_write(void)
+{
+	double bestStdio = HUGE_VAL, bestWriter = HUGE_VAL;
+	char *expected;
+	size_t lenExpected;
+	FILE *fp;
+	Writer writer;
+	bool ok;
+
+	for (int run = 0; run < NUM_RUNS; run++) {
+		double start;
+
+		fp = fopen("/dev/null", "w");
+		if (fp == NULL)
+			return false;
+		start = now();
+		write_stdio(fp);
+		fclose(fp);
+		bestStdio = MIN(bestStdio, now() - start);
+
+		if (writer_open(&writer, open("/dev/null", O_WRONLY)) < 0)
+			return false;
+		start = now();
+		write_writer(&writer);
+		writer_close(&writer);
+		close(writer.fd);
+		bestWriter = MIN(bestWriter, now() - start);
+	}
+
+	fp = open_memstream(&expected, &lenExpected);
+	if (fp == NULL)
+		return false;
+	write_stdio(fp);
+	fclose(fp);
+	report("write: fprintf", bestStdio, lenExpected);
+	report("write: writer", bestWriter, lenExpected);
+
+	if (writer_openmemory(&writer) < 0) {
+		free(expected);
+		return false;
+	}
+	write_writer(&writer);
+	ok = writer.length == lenExpected &&
+		!memcmp(writer.buffer, expected, lenExpected);
+	writer_close(&writer);
+	free(expected);
+	return ok;
+}
+
+int main(void)
+{
+	int failed = 0;
+
+	make_lines();
+	if (!bench_scan()) {
+		fprintf(stderr, "FAIL: the scanner found other positions\n");
+		failed++;
+	}
+	if (!bench_write()) {
+		fprintf(stderr, "FAIL: the writer wrote something else\n");
+		failed++;
+	}
+	free(lines);
+	free(text);
+	if (failed == 0)
+		printf("all passed\n");
+	return failed != 0;
+}
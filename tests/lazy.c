@@ -0,0 +1,89 @@
+#include "../src/tabular.h"
+
+/* Bad lines of lazy tables */
+
+static const char input[] =
+	"\n"
+	"a;b\n"
+	"1;2\n"
+	"\n"
+	"\n"
+	"\"x;3\n"
+	"4;5\n";
+
+static int load(Table *table, const char *path)
+{
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return -1;
+	fputs(input, fp);
+	if (fclose(fp) != 0)
+		return -1;
+	table_init(table);
+	table->useLazy = true;
+	table_dooperation(table, TABLE_OPERATION_INPUT, path);
+	return table->lazy == NULL ? -1 : 0;
+}
+
+static bool test_check(const char *path)
+{
+	Table table;
+	size_t lineIndex;
+	const char *line;
+	bool ok;
+
+	if (load(&table, path) < 0)
+		return false;
+	ok = table.numRows == 3 &&
+		table_checklazy(&table, &lineIndex, &line) < 0 &&
+		line != NULL && !strcmp(line, "\"x;3") && lineIndex == 5 &&
+		table.numRows == 1 && !strcmp(table_getcell(&table, 0, 1), "2");
+	/* the rest is fine now */
+	ok = ok && table_checklazy(&table, &lineIndex, &line) == 0;
+	table_uninit(&table);
+	return ok;
+}
+
+static bool test_materialize(const char *path)
+{
+	Table table;
+	bool ok;
+
+	if (load(&table, path) < 0)
+		return false;
+	ok = table_materialize(&table) < 0 &&
+		strstr(table_strerror(&table), "line no. 6") != NULL &&
+		table.numRows == 1;
+	table_uninit(&table);
+	return ok;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/tabular-XXXXXX";
+	char path[sizeof(dir) + 16];
+	int failed = 0;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/in.csv", dir);
+
+	if (!test_check(path)) {
+		fprintf(stderr, "FAIL: checking a lazy table\n");
+		failed++;
+	}
+	if (!test_materialize(path)) {
+		fprintf(stderr, "FAIL: materializing a lazy table\n");
+		failed++;
+	}
+
+	unlink(path);
+	rmdir(dir);
+	if (failed == 0)
+		printf("all passed\n");
+	return failed != 0;
+}
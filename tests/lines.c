@@ -0,0 +1,172 @@
+#include "../src/tabular.h"
+
+#include <sys/wait.h>
+
+/* A bad line is reported with its line number in the file, whichever
+ * way the file is read
+ */
+
+#define NUM_ROWS 300000
+/* in the second of four chunks */
+#define BAD_ROW 100000
+
+static char *input;
+/* the line number the error has to name */
+static size_t badLine;
+
+static char *make_input(void)
+{
+	char *text, *s;
+	size_t line = 1;
+
+	text = malloc((size_t) NUM_ROWS * 24 + 64);
+	if (text == NULL)
+		return NULL;
+	s = text + sprintf(text, "\nid;value\n\n");
+	line += 3;
+	for (int i = 0; i < NUM_ROWS; i++) {
+		if (i % 1000 == 999) {
+			*s++ = '\n';
+			line++;
+		}
+		if (i == BAD_ROW) {
+			badLine = line;
+			s += sprintf(s, "\"%d;bad\n", i);
+		} else {
+			s += sprintf(s, "%d;value\n", i);
+		}
+		line++;
+	}
+	*s = '\0';
+	return text;
+}
+
+enum load_kind {
+	LOAD_MAPPED,
+	LOAD_CHUNKED,
+	LOAD_PIPE,
+	LOAD_STREAM,
+	LOAD_LAZY,
+};
+
+static void load(const char *path, enum load_kind kind)
+{
+	struct table_command commands[] = {
+		{ TABLE_OPERATION_INPUT, path },
+		{ TABLE_OPERATION_ALL, NULL },
+		{ TABLE_OPERATION_OUTPUT, "/dev/null" },
+	};
+	char pipePath[32];
+	int fds[2];
+	pid_t pid = -1;
+	Table table;
+
+	table_init(&table);
+	table.numJobs = kind == LOAD_CHUNKED ? 4 : 1;
+	table.useLazy = kind == LOAD_LAZY;
+	if (kind == LOAD_PIPE) {
+		if (pipe(fds) < 0)
+			return;
+		pid = fork();
+		if (pid == 0) {
+			close(fds[0]);
+			write(fds[1], input, strlen(input));
+			_exit(0);
+		}
+		close(fds[1]);
+		snprintf(pipePath, sizeof(pipePath), "/dev/fd/%d", fds[0]);
+		commands[0].arg = pipePath;
+	}
+	if (kind != LOAD_STREAM || table_stream(&table, commands,
+				ARRLEN(commands)) > 0)
+		for (size_t i = 0; i < ARRLEN(commands); i++)
+			table_dooperation(&table, commands[i].operation,
+					commands[i].arg);
+	table_uninit(&table);
+	if (kind == LOAD_PIPE) {
+		close(fds[0]);
+		waitpid(pid, NULL, 0);
+	}
+}
+
+/* The line number of the error that loading prints */
+static size_t error_line(const char *path, const char *errorPath,
+		enum load_kind kind)
+{
+	char buf[4096];
+	const char *at;
+	size_t line = 0;
+	int saved, fd;
+	ssize_t length;
+
+	fd = open(errorPath, O_RDWR | O_CREAT | O_TRUNC, 0600);
+	if (fd < 0)
+		return 0;
+	fflush(stderr);
+	saved = dup(STDERR_FILENO);
+	dup2(fd, STDERR_FILENO);
+	load(path, kind);
+	fflush(stderr);
+	dup2(saved, STDERR_FILENO);
+	close(saved);
+
+	length = pread(fd, buf, sizeof(buf) - 1, 0);
+	close(fd);
+	if (length <= 0)
+		return 0;
+	buf[length] = '\0';
+	at = strstr(buf, "line no. ");
+	if (at != NULL)
+		sscanf(at, "line no. %zu", &line);
+	return line;
+}
+
+int main(void)
+{
+	static const char *const names[] = {
+		[LOAD_MAPPED] = "a mapped file",
+		[LOAD_CHUNKED] = "a file on several threads",
+		[LOAD_PIPE] = "a pipe",
+		[LOAD_STREAM] = "a streamed file",
+		[LOAD_LAZY] = "a lazy table",
+	};
+	char dir[] = "/tmp/tabular-XXXXXX";
+	char path[sizeof(dir) + 16];
+	char errorPath[sizeof(dir) + 16];
+	FILE *fp;
+	int failed = 0;
+
+	input = make_input();
+	if (input == NULL || mkdtemp(dir) == NULL) {
+		perror("setup");
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/in.csv", dir);
+	snprintf(errorPath, sizeof(errorPath), "%s/error", dir);
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror("fopen");
+		return 1;
+	}
+	fputs(input, fp);
+	fclose(fp);
+
+	for (size_t i = 0; i < ARRLEN(names); i++) {
+		const size_t line = error_line(path, errorPath, i);
+
+		if (line != badLine) {
+			fprintf(stderr, "FAIL: reading %s reports line no. %zu "
+					"instead of %zu\n", names[i], line,
+					badLine);
+			failed++;
+		}
+	}
+
+	unlink(errorPath);
+	unlink(path);
+	rmdir(dir);
+	free(input);
+	if (failed == 0)
+		printf("all passed\n");
+	return failed != 0;
+}
@@ -0,0 +1,173 @@
+#include "../src/tabular.h"
+
+/* Writing a table over the file it was read from */
+
+/* more than the reader reads ahead, so that streaming would still be
+ * reading the file when it is truncated
+ */
+#define NUM_ROWS 500000
+
+static char *input;
+static char *output;
+
+static char *make_text(bool quoted)
+{
+	const char *const format = quoted ? "\"fruit_%d\";\"%d\"\n" :
+		"fruit_%d;%d\n";
+	char *text, *s;
+
+	text = malloc(NUM_ROWS * 32 + 32);
+	if (text == NULL)
+		return NULL;
+	s = text + sprintf(text, quoted ? "\"name\";\"count\"\n" :
+			"name;count\n\n");
+	for (int i = 0; i < NUM_ROWS; i++)
+		s += sprintf(s, format, i, i % 7);
+	return text;
+}
+
+static int write_file(const char *path, const char *text)
+{
+	FILE *fp;
+
+	fp = fopen(path, "w");
+	if (fp == NULL)
+		return -1;
+	fputs(text, fp);
+	return fclose(fp);
+}
+
+static bool check_file(const char *path, const char *text)
+{
+	const size_t length = strlen(text);
+	char *buf;
+	FILE *fp;
+	size_t n;
+	bool same;
+
+	fp = fopen(path, "r");
+	if (fp == NULL)
+		return false;
+	buf = malloc(length + 1);
+	n = buf == NULL ? 0 : fread(buf, 1, length + 1, fp);
+	fclose(fp);
+	same = n == length && !memcmp(buf, text, length);
+	if (!same)
+		fprintf(stderr, "expected %zu bytes, got %zu\n", length, n);
+	free(buf);
+	return same;
+}
+
+static bool test_overwrite(const char *path)
+{
+	Table table;
+	bool ok;
+
+	if (write_file(path, input) < 0)
+		return false;
+	table_init(&table);
+	table_dooperation(&table, TABLE_OPERATION_INPUT, path);
+	table_dooperation(&table, TABLE_OPERATION_ALL, NULL);
+	table_dooperation(&table, TABLE_OPERATION_OUTPUT, path);
+	/* the table still reads its rows from the old file */
+	ok = table.numRows == NUM_ROWS && !strcmp(table_getcell(&table,
+				NUM_ROWS - 1, 0), "fruit_499999");
+	table_uninit(&table);
+	return ok && check_file(path, output);
+}
+
+/* the same as the command line, which streams the rows when it can */
+static bool test_overwritestream(const char *path)
+{
+	struct table_command commands[] = {
+		{ TABLE_OPERATION_INPUT, path },
+		{ TABLE_OPERATION_ALL, NULL },
+		{ TABLE_OPERATION_OUTPUT, path },
+	};
+	Table table;
+	int code;
+
+	if (write_file(path, input) < 0)
+		return false;
+	table_init(&table);
+	code = table_stream(&table, commands, ARRLEN(commands));
+	if (code > 0)
+		for (size_t i = 0; i < ARRLEN(commands); i++)
+			table_dooperation(&table, commands[i].operation,
+					commands[i].arg);
+	table_uninit(&table);
+	return code >= 0 && check_file(path, output);
+}
+
+/* unchanged rows are copied from the input with --quote keep */
+static bool test_overwritekept(const char *path, const char *otherPath)
+{
+	Table table;
+	char *expected = NULL;
+	FILE *fp;
+	long length;
+	bool ok = false;
+
+	if (write_file(path, input) < 0)
+		return false;
+	table_init(&table);
+	table_dooperation(&table, TABLE_OPERATION_QUOTE, "keep");
+	table_dooperation(&table, TABLE_OPERATION_INPUT, path);
+	table_dooperation(&table, TABLE_OPERATION_ALL, NULL);
+	table_setcell(&table, 1, 0, "changed");
+	table_dooperation(&table, TABLE_OPERATION_OUTPUT, otherPath);
+	table_dooperation(&table, TABLE_OPERATION_OUTPUT, path);
+	table_uninit(&table);
+
+	fp = fopen(otherPath, "r");
+	if (fp == NULL)
+		return false;
+	if (fseek(fp, 0, SEEK_END) == 0 && (length = ftell(fp)) > 0 &&
+			(expected = malloc(length + 1)) != NULL) {
+		rewind(fp);
+		expected[fread(expected, 1, length, fp)] = '\0';
+		ok = check_file(path, expected);
+	}
+	fclose(fp);
+	free(expected);
+	unlink(otherPath);
+	return ok;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/tabular-XXXXXX";
+	char path[sizeof(dir) + 16];
+	char otherPath[sizeof(dir) + 16];
+	int failed = 0;
+
+	input = make_text(false);
+	output = make_text(true);
+	if (input == NULL || output == NULL || mkdtemp(dir) == NULL) {
+		perror("setup");
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/in.csv", dir);
+	snprintf(otherPath, sizeof(otherPath), "%s/out.csv", dir);
+
+	if (!test_overwrite(path)) {
+		fprintf(stderr, "FAIL: writing over the input\n");
+		failed++;
+	}
+	if (!test_overwritestream(path)) {
+		fprintf(stderr, "FAIL: streaming over the input\n");
+		failed++;
+	}
+	if (!test_overwritekept(path, otherPath)) {
+		fprintf(stderr, "FAIL: keeping rows of the input\n");
+		failed++;
+	}
+
+	unlink(path);
+	rmdir(dir);
+	free(input);
+	free(output);
+	if (failed == 0)
+		printf("all passed\n");
+	return failed != 0;
+}
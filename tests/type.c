@@ -0,0 +1,104 @@
+#include "../src/tabular.h"
+
+/* Native values of numeric columns and the comparisons that use them */
+
+static const char input[] =
+	"id;price;name\n"
+	"1;2.5;apple\n"
+	"2;;pear\n"
+	"3;10;plum\n"
+	"-4;0.25;fig\n";
+
+static size_t count_compared(Table *table, size_t col, const char *comparison)
+{
+	uint64_t set[1] = { 0 };
+	size_t count = 0;
+
+	if (table_comparerows(table, col, comparison, NULL, table->numRows,
+				set) < 0)
+		return SIZE_MAX;
+	for (size_t row = 0; row < table->numRows; row++)
+		count += table_inset(set, row);
+	return count;
+}
+
+static bool test_types(Table *table)
+{
+	return table_gettype(table, 0) == TABLE_TYPE_INT &&
+		table_gettype(table, 1) == TABLE_TYPE_DOUBLE &&
+		table_gettype(table, 2) == TABLE_TYPE_STRING &&
+		table->columns[0].values.ints[3] == -4 &&
+		table->columns[1].values.doubles[0] == 2.5 &&
+		table_isnull(table, 1, 1) && !table_isnull(table, 2, 1);
+}
+
+static bool test_compare(Table *table)
+{
+	return count_compared(table, 0, ">1") == 2 &&
+		count_compared(table, 0, ">=1") == 3 &&
+		count_compared(table, 0, "<0.5") == 1 &&
+		/* the empty price never matches */
+		count_compared(table, 1, "<100") == 3 &&
+		count_compared(table, 1, "<=2.5") == 2 &&
+		count_compared(table, 2, ">1") == SIZE_MAX &&
+		count_compared(table, 0, ">one") == SIZE_MAX;
+}
+
+/* a changed cell drops the values, the next comparison sees it */
+static bool test_change(Table *table)
+{
+	if (table_setcell(table, 1, 1, "7") < 0 ||
+			table->columns[1].type != TABLE_TYPE_UNKNOWN)
+		return false;
+	if (count_compared(table, 1, ">5") != 2 ||
+			table->columns[1].values.doubles[1] != 7)
+		return false;
+	if (table_setcell(table, 0, 1, "cheap") < 0)
+		return false;
+	return count_compared(table, 1, ">5") == SIZE_MAX &&
+		table_gettype(table, 1) == TABLE_TYPE_STRING;
+}
+
+int main(void)
+{
+	char dir[] = "/tmp/tabular-XXXXXX";
+	char path[sizeof(dir) + 16];
+	Table table;
+	FILE *fp;
+	int failed = 0;
+
+	if (mkdtemp(dir) == NULL) {
+		perror("mkdtemp");
+		return 1;
+	}
+	snprintf(path, sizeof(path), "%s/in.csv", dir);
+	fp = fopen(path, "w");
+	if (fp == NULL) {
+		perror("fopen");
+		return 1;
+	}
+	fputs(input, fp);
+	fclose(fp);
+	table_init(&table);
+	table_dooperation(&table, TABLE_OPERATION_INPUT, path);
+
+	if (!test_types(&table)) {
+		fprintf(stderr, "FAIL: inferring the types\n");
+		failed++;
+	}
+	if (!test_compare(&table)) {
+		fprintf(stderr, "FAIL: comparing numbers\n");
+		failed++;
+	}
+	if (!test_change(&table)) {
+		fprintf(stderr, "FAIL: changing a typed column\n");
+		failed++;
+	}
+
+	table_uninit(&table);
+	unlink(path);
+	rmdir(dir);
+	if (failed == 0)
+		printf("all passed\n");
+	return failed != 0;
+}